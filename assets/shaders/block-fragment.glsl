@@ -4,10 +4,12 @@ out vec4 fragColor;
 in vec2 texcoords;
 in vec2 index_texcoords;
 layout(binding = 0) uniform sampler2DArray textures;
-layout(binding = 1) uniform usampler2D chunk_index_texture;
+layout(binding = 1) uniform usampler2DArray index_atlas;
+layout(location = 6) uniform ivec3 index_region_origin; // Where the chunk's index texture is in the index atlas, and its layer
 
 void main()
 {
-    uint texture_index = texelFetch(chunk_index_texture, ivec2(index_texcoords.x + int(texcoords.x), index_texcoords.y + int(texcoords.y)), 0).x;
+    ivec2 index = index_region_origin.xy + ivec2(index_texcoords.x + int(texcoords.x), index_texcoords.y + int(texcoords.y));
+    uint texture_index = texelFetch(index_atlas, ivec3(index, index_region_origin.z), 0).x;
     fragColor = texture(textures, vec3(texcoords, texture_index));
 }
\ No newline at end of file
@@ -0,0 +1,11 @@
+#version 430 core
+out vec4 fragColor;
+
+in vec2 texcoords;
+flat in uint texture_layer;
+layout(binding = 0) uniform sampler2DArray textures;
+
+void main()
+{
+    fragColor = texture(textures, vec3(texcoords, texture_layer));
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+#version 430 core
+// Each face is packed like a vertex (see BLOCK_VERTEX, in rendering.h), but its position is the corner of the face nearest the origin and its texture coordinates are
+// the width and height of the face. Every face is drawn as six vertices, two triangles over its corners in the same order as the shared quad index buffer
+layout(std430, binding = 0) readonly buffer chunk_faces { uvec2 packed_faces[]; };
+
+layout (location = 3) uniform mat4 model;
+layout (location = 4) uniform mat4 view;
+layout (location = 5) uniform mat4 projection;
+
+out vec2 texcoords;
+out vec2 index_texcoords;
+flat out uint texture_layer; // Only used with face layers, where the index texture coordinates hold the layer instead
+
+// The four corners of each face of a unit cube, with the face moved onto its nearest corner, and their texture coordinates.
+// These are the corners block_vertex uses, from faces, quad_corners and face_texcoords in world.h
+const int quad_pattern[6] = int[](0, 1, 2, 2, 1, 3);
+const vec3 corner_positions[24] = vec3[](
+    vec3(0, 0, 0), vec3(0, 1, 0), vec3(1, 0, 0), vec3(1, 1, 0),
+    vec3(0, 0, 0), vec3(1, 0, 0), vec3(0, 1, 0), vec3(1, 1, 0),
+    vec3(0, 0, -1), vec3(0, 1, -1), vec3(0, 0, 0), vec3(0, 1, 0),
+    vec3(0, 0, 0), vec3(0, 1, 0), vec3(0, 0, -1), vec3(0, 1, -1),
+    vec3(0, 0, 0), vec3(0, 0, -1), vec3(1, 0, 0), vec3(1, 0, -1),
+    vec3(1, 0, 0), vec3(1, 0, -1), vec3(0, 0, 0), vec3(0, 0, -1));
+const vec2 corner_texcoords[24] = vec2[](
+    vec2(0, 0), vec2(0, 1), vec2(1, 0), vec2(1, 1),
+    vec2(1, 0), vec2(0, 0), vec2(1, 1), vec2(0, 1),
+    vec2(0, 0), vec2(0, 1), vec2(1, 0), vec2(1, 1),
+    vec2(0, 0), vec2(0, 1), vec2(1, 0), vec2(1, 1),
+    vec2(0, 0), vec2(0, 1), vec2(1, 0), vec2(1, 1),
+    vec2(1, 1), vec2(1, 0), vec2(0, 1), vec2(0, 0));
+const int face_u_axes[6] = int[](0, 0, 2, 2, 0, 0), face_v_axes[6] = int[](1, 1, 1, 1, 2, 2); // The axes along the width and height of each face, as in world.h
+
+void main()
+{
+    uvec2 packed_face = packed_faces[gl_VertexID / 6];
+    int face = int((packed_face.x >> 27) & 7u), corner = (face * 4) + quad_pattern[gl_VertexID % 6];
+    vec3 origin = vec3(packed_face.x & 63u, (packed_face.x >> 6) & 511u, -float((packed_face.x >> 15) & 63u));
+    vec2 size = vec2((packed_face.x >> 21) & 63u, packed_face.y & 511u);
+
+    vec3 scale = vec3(0);
+    scale[face_u_axes[face]] = size.x;
+    scale[face_v_axes[face]] = size.y;
+    vec3 pos = origin + (corner_positions[corner] * scale);
+    gl_Position = projection * view * model  * vec4(pos, 1.0);
+    texcoords = corner_texcoords[corner] * size;
+    index_texcoords = vec2((packed_face.y >> 9) & 2047u, (packed_face.y >> 20) & 2047u);
+    texture_layer = (packed_face.y >> 9) & 2047u;
+}
\ No newline at end of file
@@ -1,7 +1,5 @@
 #version 430 core
-layout(location = 0) in vec3 pos;
-layout(location = 1) in vec2 uv;
-layout(location = 2) in vec2 uv2;
+layout(location = 5) in uvec2 packed_vertex; // Laid out as described above BLOCK_VERTEX, in rendering.h
 
 layout (location = 3) uniform mat4 model;
 layout (location = 4) uniform mat4 view;
@@ -9,10 +7,13 @@ layout (location = 5) uniform mat4 projection;
 
 out vec2 texcoords;
 out vec2 index_texcoords;
+flat out uint texture_layer; // Only used with face layers, where the index texture coordinates hold the layer instead
 
 void main()
 {
+    vec3 pos = vec3(packed_vertex.x & 63u, (packed_vertex.x >> 6) & 511u, -float((packed_vertex.x >> 15) & 63u));
     gl_Position = projection * view * model  * vec4(pos, 1.0);
-    texcoords = uv;
-    index_texcoords = uv2;
+    texcoords = vec2((packed_vertex.x >> 21) & 63u, packed_vertex.y & 511u);
+    index_texcoords = vec2((packed_vertex.y >> 9) & 2047u, (packed_vertex.y >> 20) & 2047u);
+    texture_layer = (packed_vertex.y >> 9) & 2047u;
 }
\ No newline at end of file
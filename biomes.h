@@ -0,0 +1,194 @@
+#ifndef BIOMES_H
+#define BIOMES_H
+#include<SDL2/SDL.h>
+
+#include"util.h"
+#include"noise.h"
+#include"blocks.h"
+#include"terrain.h"
+#include"structures.h"
+
+#define BIOME_REGION_SIZE 512 // The width and depth of the area each set of climate maps covers, in number of blocks
+#define BIOME_MAP_RESOLUTION 16 // The distance between samples in the climate maps, in number of blocks
+#define BIOME_MAP_SIZE (BIOME_REGION_SIZE / BIOME_MAP_RESOLUTION + 1) // The number of samples along each side of the climate maps (plus the far edge, so every point in the region can be interpolated)
+#define BIOME_CACHE_SIZE 16 // The number of regions to keep the climate maps for - the least recently used region is replaced when a new one is needed
+
+#define NUM_BIOMES 5
+typedef enum { OCEAN, PLAINS, FOREST, BARREN, MOUNTAINS } BIOME;
+const char* biome_names[] = { "Ocean", "Plains", "Forest", "Barren", "Mountains" };
+
+typedef struct CLIMATE
+{
+    float temperature, moisture, continentalness; // All in the range 0 to 1 - continentalness is how far inland the point is, with low values being ocean
+} CLIMATE;
+
+typedef struct BIOME_PALETTE
+{
+    BLOCK_TYPE surface, filler; // The block on top of each column, and the blocks in the layer just below it
+    unsigned int structures[NUM_STRUCTURE_TYPES]; // How many of each type of structure (trees, bushes, boulders) to try to place in each chunk
+} BIOME_PALETTE;
+
+const BIOME_PALETTE biome_palettes[] = {
+    { .surface = SOIL,  .filler = SOIL,  .structures = { 0, 0, 0 } },  // Ocean
+    { .surface = GRASS, .filler = SOIL,  .structures = { 3, 4, 0 } },  // Plains
+    { .surface = GRASS, .filler = SOIL,  .structures = { 16, 2, 0 } }, // Forest
+    { .surface = SOIL,  .filler = STONE, .structures = { 0, 0, 3 } },  // Barren
+    { .surface = STONE, .filler = STONE, .structures = { 1, 0, 4 } }   // Mountains
+};
+
+// Each climate map is sampled from its own slice of the noise, at a much lower frequency than the terrain
+const double climate_frequencies[] = { 0.0015, 0.002, 0.001 };
+const double climate_offsets[] = { 101.0, 211.0, 307.0 };
+
+typedef struct BIOME_REGION
+{
+    int region_x, region_z;
+    unsigned long last_used;
+    bool valid;
+    CLIMATE map[BIOME_MAP_SIZE * BIOME_MAP_SIZE];
+} BIOME_REGION;
+
+BIOME_REGION biome_cache[BIOME_CACHE_SIZE];
+unsigned long biome_cache_uses = 0;
+SDL_mutex* biome_cache_lock;
+
+void init_biomes()
+{
+    if(!(biome_cache_lock = SDL_CreateMutex())) exit_with_error("Could not create the biome cache lock", SDL_GetError());
+    memset(biome_cache, 0, sizeof(biome_cache));
+}
+
+int floor_divide(int value, int divisor) { return value >= 0 ? value / divisor : -((-value + divisor - 1) / divisor); }
+
+float climate_noise(unsigned int map, double u, double v) { return (simplex_noise(u * climate_frequencies[map], v * climate_frequencies[map], climate_offsets[map]) + 1.0) / 2.0; }
+
+void compute_biome_region(BIOME_REGION* region)
+{
+    for(unsigned int b = 0; b < BIOME_MAP_SIZE; b++)
+    {
+        for(unsigned int a = 0; a < BIOME_MAP_SIZE; a++)
+        {
+            double u = region->region_x * BIOME_REGION_SIZE + a * BIOME_MAP_RESOLUTION, v = region->region_z * BIOME_REGION_SIZE + b * BIOME_MAP_RESOLUTION;
+            CLIMATE* sample = region->map + (b * BIOME_MAP_SIZE) + a;
+            sample->temperature = climate_noise(0, u, v);
+            sample->moisture = climate_noise(1, u, v);
+            sample->continentalness = climate_noise(2, u, v);
+        }
+    }
+}
+
+// Returns the cached climate maps for a region, or NULL if they aren't cached. The cache lock must be held
+BIOME_REGION* find_biome_region(int region_x, int region_z)
+{
+    for(unsigned int i = 0; i < BIOME_CACHE_SIZE; i++)
+    {
+        BIOME_REGION* region = biome_cache + i;
+        if(region->valid && region->region_x == region_x && region->region_z == region_z)
+        {
+            region->last_used = ++biome_cache_uses;
+            return region;
+        }
+    }
+    return NULL;
+}
+
+// Copies freshly computed climate maps over the least recently used region, and returns the cached copy. Another thread may have cached the same region
+// while these were being computed, in which case that copy is returned instead. The cache lock must be held
+BIOME_REGION* cache_biome_region(const BIOME_REGION* computed)
+{
+    BIOME_REGION* least_recently_used = find_biome_region(computed->region_x, computed->region_z);
+    if(least_recently_used) return least_recently_used;
+    least_recently_used = biome_cache;
+    for(unsigned int i = 0; i < BIOME_CACHE_SIZE; i++)
+    {
+        BIOME_REGION* region = biome_cache + i;
+        if(!region->valid || (least_recently_used->valid && region->last_used < least_recently_used->last_used)) least_recently_used = region;
+    }
+
+    *least_recently_used = *computed;
+    least_recently_used->valid = true;
+    least_recently_used->last_used = ++biome_cache_uses;
+    return least_recently_used;
+}
+
+CLIMATE mix_climate(CLIMATE from, CLIMATE to, float amount)
+{
+    from.temperature += (to.temperature - from.temperature) * amount;
+    from.moisture += (to.moisture - from.moisture) * amount;
+    from.continentalness += (to.continentalness - from.continentalness) * amount;
+    return from;
+}
+
+// Fills climate with points_per_side x points_per_side samples spaced step blocks apart, starting at (u, v), interpolated from the cached region maps.
+// The samples must all lie in the same region as (u, v) - this always holds for a chunk, since regions are a whole number of chunks wide
+void sample_climate(CLIMATE* climate, int u, int v, unsigned int points_per_side, unsigned int step)
+{
+    int region_x = floor_divide(u, BIOME_REGION_SIZE), region_z = floor_divide(v, BIOME_REGION_SIZE);
+    unsigned int local_u = u - region_x * BIOME_REGION_SIZE, local_v = v - region_z * BIOME_REGION_SIZE;
+
+    // A missing region is computed without holding the lock, so that other threads can keep using the regions which are cached in the meantime
+    SDL_LockMutex(biome_cache_lock);
+    BIOME_REGION* region = find_biome_region(region_x, region_z);
+    if(!region)
+    {
+        SDL_UnlockMutex(biome_cache_lock);
+        BIOME_REGION computed = { .region_x = region_x, .region_z = region_z };
+        compute_biome_region(&computed);
+        SDL_LockMutex(biome_cache_lock);
+        region = cache_biome_region(&computed);
+    }
+    for(unsigned int b = 0; b < points_per_side; b++)
+    {
+        unsigned int map_v = local_v + b * step, row = map_v / BIOME_MAP_RESOLUTION;
+        float fraction_v = (float)(map_v % BIOME_MAP_RESOLUTION) / BIOME_MAP_RESOLUTION;
+        if(row == BIOME_MAP_SIZE - 1) { row--; fraction_v = 1.0f; }
+        for(unsigned int a = 0; a < points_per_side; a++)
+        {
+            unsigned int map_u = local_u + a * step, column = map_u / BIOME_MAP_RESOLUTION;
+            float fraction_u = (float)(map_u % BIOME_MAP_RESOLUTION) / BIOME_MAP_RESOLUTION;
+            if(column == BIOME_MAP_SIZE - 1) { column--; fraction_u = 1.0f; }
+
+            CLIMATE* corner = region->map + (row * BIOME_MAP_SIZE) + column;
+            CLIMATE near_row = mix_climate(corner[0], corner[1], fraction_u), far_row = mix_climate(corner[BIOME_MAP_SIZE], corner[BIOME_MAP_SIZE + 1], fraction_u);
+            climate[(b * points_per_side) + a] = mix_climate(near_row, far_row, fraction_v);
+        }
+    }
+    SDL_UnlockMutex(biome_cache_lock);
+}
+
+BIOME biome_from_climate(CLIMATE climate)
+{
+    if(climate.continentalness < 0.35f) return OCEAN;
+    if(climate.continentalness > 0.68f) return MOUNTAINS;
+    if(climate.temperature > 0.65f && climate.moisture < 0.4f) return BARREN;
+    if(climate.moisture > 0.55f) return FOREST;
+    return PLAINS;
+}
+
+// The height of the terrain changes smoothly with the climate rather than with the biome, so that there are no cliffs where biomes meet.
+// Inland areas are raised and more rugged, while areas out to sea are lowered below the water level and flattened
+float climate_height_scale(CLIMATE climate) { return 0.3f + climate.continentalness * climate.continentalness * 2.2f; }
+float climate_height_offset(CLIMATE climate) { return (climate.continentalness - 0.4f) * 30.0f; }
+
+// Fills height_scales and height_offsets with the climate's effect on the terrain at each point of a points_per_side x points_per_side lattice
+void climate_height_lattice(float* height_scales, float* height_offsets, int u, int v, unsigned int points_per_side, unsigned int step)
+{
+    CLIMATE climate[TERRAIN_MAX_LATTICE_POINTS];
+    sample_climate(climate, u, v, points_per_side, step);
+    for(unsigned int i = 0; i < points_per_side * points_per_side; i++)
+    {
+        height_scales[i] = climate_height_scale(climate[i]);
+        height_offsets[i] = climate_height_offset(climate[i]);
+    }
+}
+
+// Fills heights with the height of the terrain above the base level for each column of the width x width area starting at (u, v), shaped by the climate
+void climate_terrain_heightmap(float* heights, int u, int v, unsigned int width)
+{
+    float height_scales[TERRAIN_MAX_LATTICE_POINTS], height_offsets[TERRAIN_MAX_LATTICE_POINTS];
+    unsigned int step = terrain_lattice_step(width);
+    climate_height_lattice(height_scales, height_offsets, u, v, width / step + 1, step);
+    terrain_heightmap(heights, u, v, height_scales, height_offsets, width);
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,215 @@
+#ifndef INDEX_ATLAS_H
+#define INDEX_ATLAS_H
+#include<stdlib.h>
+#include<string.h>
+#include<glad/glad.h>
+
+#include"util.h"
+
+// Rather than every chunk having an index texture of its own, the texture indices of every chunk and LOD chunk share one index atlas - a texture array of
+// single byte layers (a block's texture is always less than 256), which each chunk is handed a rectangular region of when it is uploaded. The regions are
+// packed with a guillotine packer: the free space is a list of rectangles, a region is cut from the one it fits best, and what's left of that rectangle is
+// split in two along the shorter leftover side. Freed regions go back on the list, and are merged with any free rectangle they share a whole side with.
+// That misses free space split up differently on either side of a seam, so whenever there are more than twice as many free rectangles as regions handed out
+// (and one for each layer), the list is rebuilt from scratch - at most once every few frees, since it might not get any shorter.
+// When nothing fits, the atlas doubles its number of layers. Only call these from the thread which owns the opengl context
+#define INDEX_ATLAS_SIZE 2048 // The width and height of each layer of the index atlas
+#define INDEX_ATLAS_INITIAL_LAYERS 4 // The number of layers the index atlas starts out with
+#define INDEX_ATLAS_GRANULARITY 16 // Regions are rounded up to a multiple of this many texels each way, so that a chunk rebuilt a little bigger usually still fits
+#define INDEX_ATLAS_REBUILD_INTERVAL 64 // The fewest regions freed between rebuilding the free list
+
+typedef struct INDEX_REGION
+{
+    int x, y, layer; // In this order so that they can be passed straight to the index region uniform
+    int width, height; // A region with no height hasn't been allocated
+} INDEX_REGION;
+
+unsigned int index_atlas_texture = 0, index_atlas_layers = 0;
+unsigned long index_atlas_allocated_texels = 0, index_atlas_num_regions = 0; // The area and the number of the regions handed out
+INDEX_REGION* index_atlas_free = NULL; // The free rectangles
+unsigned int index_atlas_num_free = 0, index_atlas_free_capacity = 0;
+unsigned int index_atlas_frees_since_rebuild = 0;
+
+void add_free_index_rectangle(INDEX_REGION rectangle) // Internal
+{
+    if(rectangle.width <= 0 || rectangle.height <= 0) return;
+    if(index_atlas_num_free == index_atlas_free_capacity)
+    {
+        unsigned int capacity = index_atlas_free_capacity ? index_atlas_free_capacity * 2 : 256;
+        INDEX_REGION* free_rectangles = realloc(index_atlas_free, capacity * sizeof(INDEX_REGION));
+        if(!free_rectangles) exit_with_error("Memory allocation error", "realloc() failed while growing the index atlas' free list");
+        index_atlas_free = free_rectangles;
+        index_atlas_free_capacity = capacity;
+    }
+    index_atlas_free[index_atlas_num_free++] = rectangle;
+}
+
+// Marks every free cell of granularity by granularity texels, then cuts the free space up again into as few rectangles as it can - reading along the rows,
+// each free cell which isn't covered yet starts a rectangle as wide as the free cells run, which is then made as tall as the rows below are free that wide
+void rebuild_index_atlas_free_list() // Internal
+{
+    unsigned int cells = INDEX_ATLAS_SIZE / INDEX_ATLAS_GRANULARITY, layer_cells = cells * cells;
+    unsigned char* free_cells = calloc((size_t)index_atlas_layers * layer_cells, sizeof(unsigned char));
+    if(!free_cells) exit_with_error("Memory allocation error", "calloc() failed while rebuilding the index atlas' free list");
+    for(unsigned int i = 0; i < index_atlas_num_free; i++)
+    {
+        INDEX_REGION* rectangle = index_atlas_free + i;
+        for(int y = rectangle->y / INDEX_ATLAS_GRANULARITY; y < (rectangle->y + rectangle->height) / INDEX_ATLAS_GRANULARITY; y++)
+            memset(free_cells + (rectangle->layer * layer_cells) + (y * cells) + (rectangle->x / INDEX_ATLAS_GRANULARITY), 1, rectangle->width / INDEX_ATLAS_GRANULARITY);
+    }
+
+    index_atlas_num_free = 0;
+    for(unsigned int layer = 0; layer < index_atlas_layers; layer++)
+    {
+        unsigned char* layer_free = free_cells + (layer * layer_cells);
+        for(unsigned int y = 0; y < cells; y++)
+        {
+            for(unsigned int x = 0; x < cells; x++)
+            {
+                if(!layer_free[(y * cells) + x]) continue;
+                unsigned int width = 1, height = 1;
+                while(x + width < cells && layer_free[(y * cells) + x + width]) width++;
+                for(bool row_free = true; row_free && y + height < cells; height += row_free)
+                    for(unsigned int i = 0; row_free && i < width; i++) row_free = layer_free[((y + height) * cells) + x + i];
+                for(unsigned int i = 0; i < height; i++) memset(layer_free + ((y + i) * cells) + x, 0, width);
+                add_free_index_rectangle((INDEX_REGION){ x * INDEX_ATLAS_GRANULARITY, y * INDEX_ATLAS_GRANULARITY, layer, width * INDEX_ATLAS_GRANULARITY, height * INDEX_ATLAS_GRANULARITY });
+            }
+        }
+    }
+    free(free_cells);
+}
+
+// Makes a new index atlas texture with new_layers layers, copies the old one's layers into it, and adds the new layers to the free list
+void grow_index_atlas(unsigned int new_layers) // Internal
+{
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_R8UI, INDEX_ATLAS_SIZE, INDEX_ATLAS_SIZE, new_layers);
+    if(index_atlas_texture)
+    {
+        glCopyImageSubData(index_atlas_texture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, texture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, INDEX_ATLAS_SIZE, INDEX_ATLAS_SIZE, index_atlas_layers);
+        glDeleteTextures(1, &index_atlas_texture);
+    }
+    for(unsigned int layer = index_atlas_layers; layer < new_layers; layer++)
+        add_free_index_rectangle((INDEX_REGION){ .layer = layer, .width = INDEX_ATLAS_SIZE, .height = INDEX_ATLAS_SIZE });
+    index_atlas_texture = texture;
+    index_atlas_layers = new_layers;
+}
+
+// Hands out a region of the index atlas at least width by height texels, growing the atlas if there isn't room
+INDEX_REGION allocate_index_region(unsigned int width, unsigned int height)
+{
+    width = ((width + INDEX_ATLAS_GRANULARITY - 1) / INDEX_ATLAS_GRANULARITY) * INDEX_ATLAS_GRANULARITY;
+    height = ((height + INDEX_ATLAS_GRANULARITY - 1) / INDEX_ATLAS_GRANULARITY) * INDEX_ATLAS_GRANULARITY;
+    if(!width || !height) width = height = INDEX_ATLAS_GRANULARITY;
+    if(width > INDEX_ATLAS_SIZE || height > INDEX_ATLAS_SIZE) exit_with_error("Index atlas error", "A region was asked for which is bigger than a whole layer of the index atlas");
+    while(true)
+    {
+        // The free rectangle which leaves the least space along its shorter side, or failing that the one in the lowest layer
+        int best = -1, best_fit = 0;
+        for(unsigned int i = 0; i < index_atlas_num_free; i++)
+        {
+            INDEX_REGION* rectangle = index_atlas_free + i;
+            if(rectangle->width < (int)width || rectangle->height < (int)height) continue;
+            int fit = rectangle->width - width < rectangle->height - height ? rectangle->width - width : rectangle->height - height;
+            if(best < 0 || fit < best_fit || (fit == best_fit && rectangle->layer < index_atlas_free[best].layer)) best = i, best_fit = fit;
+        }
+        if(best < 0)
+        {
+            grow_index_atlas(index_atlas_layers ? index_atlas_layers * 2 : INDEX_ATLAS_INITIAL_LAYERS);
+            continue;
+        }
+
+        INDEX_REGION rectangle = index_atlas_free[best];
+        index_atlas_free[best] = index_atlas_free[--index_atlas_num_free];
+        INDEX_REGION to_return = { rectangle.x, rectangle.y, rectangle.layer, width, height };
+
+        // What's left is split along the shorter leftover side, so that the bigger of the two pieces is as big as possible
+        int leftover_width = rectangle.width - width, leftover_height = rectangle.height - height;
+        bool split_across = leftover_width < leftover_height;
+        add_free_index_rectangle((INDEX_REGION){ rectangle.x + width, rectangle.y, rectangle.layer, leftover_width, split_across ? (int)height : rectangle.height });
+        add_free_index_rectangle((INDEX_REGION){ rectangle.x, rectangle.y + height, rectangle.layer, split_across ? rectangle.width : (int)width, leftover_height });
+        index_atlas_allocated_texels += width * height;
+        index_atlas_num_regions++;
+        return to_return;
+    }
+}
+
+// Whether a region can hold width by height texels without wasting most of itself
+bool index_region_fits(INDEX_REGION region, unsigned int width, unsigned int height)
+{
+    return region.height && region.width >= (int)width && region.height >= (int)height &&
+           region.width <= (int)width * 2 + INDEX_ATLAS_GRANULARITY && region.height <= (int)height * 2 + INDEX_ATLAS_GRANULARITY;
+}
+
+// Gives a region back to the atlas, and clears it. Regions which were never allocated are left alone
+void free_index_region(INDEX_REGION* region)
+{
+    if(!region->height) return;
+    index_atlas_allocated_texels -= region->width * region->height;
+    index_atlas_num_regions--;
+    INDEX_REGION freed = *region;
+    *region = (INDEX_REGION){ 0 };
+
+    // Keep merging the freed rectangle with any free rectangle sharing a whole side with it, until there aren't any left
+    for(bool merged = true; merged;)
+    {
+        merged = false;
+        for(unsigned int i = 0; i < index_atlas_num_free; i++)
+        {
+            INDEX_REGION* other = index_atlas_free + i;
+            if(other->layer != freed.layer) continue;
+            bool same_columns = other->x == freed.x && other->width == freed.width, same_rows = other->y == freed.y && other->height == freed.height;
+            if(same_columns && (other->y + other->height == freed.y || freed.y + freed.height == other->y))
+            {
+                freed.y = other->y < freed.y ? other->y : freed.y;
+                freed.height += other->height;
+            }
+            else if(same_rows && (other->x + other->width == freed.x || freed.x + freed.width == other->x))
+            {
+                freed.x = other->x < freed.x ? other->x : freed.x;
+                freed.width += other->width;
+            }
+            else continue;
+            index_atlas_free[i] = index_atlas_free[--index_atlas_num_free];
+            merged = true;
+            break;
+        }
+    }
+    add_free_index_rectangle(freed);
+    if(++index_atlas_frees_since_rebuild < INDEX_ATLAS_REBUILD_INTERVAL || index_atlas_num_free <= index_atlas_num_regions * 2 + index_atlas_layers) return;
+    rebuild_index_atlas_free_list();
+    index_atlas_frees_since_rebuild = 0;
+}
+
+// Uploads width by height texture indices into the corner of a region, from data where each row is row_length indices long
+void upload_index_region(INDEX_REGION region, const unsigned char* data, unsigned int row_length, unsigned int width, unsigned int height)
+{
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, index_atlas_texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, row_length);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, region.x, region.y, region.layer, width, height, 1, GL_RED_INTEGER, GL_UNSIGNED_BYTE, data);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+// The number of bytes of gpu memory the index atlas takes up
+size_t index_atlas_memory() { return (size_t)index_atlas_layers * INDEX_ATLAS_SIZE * INDEX_ATLAS_SIZE; }
+
+void unload_index_atlas()
+{
+    if(index_atlas_texture) glDeleteTextures(1, &index_atlas_texture);
+    free(index_atlas_free);
+    index_atlas_texture = index_atlas_layers = 0;
+    index_atlas_free = NULL;
+    index_atlas_num_free = index_atlas_free_capacity = 0;
+    index_atlas_frees_since_rebuild = 0;
+    index_atlas_allocated_texels = index_atlas_num_regions = 0;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,213 @@
+#ifndef LOD_H
+#define LOD_H
+#include<stdlib.h>
+#include<string.h>
+#include<glad/glad.h>
+
+#include"util.h"
+#include"terrain.h"
+#include"biomes.h"
+#include"world.h"
+#include"rendering.h"
+
+// Far away chunks only need the shape of the terrain, so instead of the full blocks, fill state trees and structures, a level of detail (LOD) chunk
+// only samples the height and the top block of one column out of every decimation x decimation, and draws each of these as a single flat cell.
+// Each cell has walls down to any lower neighbours, and the cells at the edge of the chunk hang a skirt down, which covers the gaps where
+// LOD chunks with different decimations (or full chunks) meet
+#define LOD_MIN_DECIMATION 2
+#define LOD_MAX_DECIMATION 8
+#define LOD_MAX_CELLS (CHUNK_SIZE / LOD_MIN_DECIMATION) // The most cells there can be along each side of a LOD chunk
+#define LOD_SKIRT_DEPTH 2 // How far the skirts at the edges reach below the cells, in multiples of the decimation
+
+// The index texture has the top of every column in the bottom left corner (as a cell is decimation blocks wide, each column of its texture indices
+// is its top block), and a strip for each type of block next to it, which all the walls of that type share. With face layers (see BLOCK_TEXTURING in world.h)
+// every top and wall only has one texture anyway, so LOD chunks don't have an index texture either
+#define LOD_INDEX_TEXTURE_WIDTH (CHUNK_SIZE + LOD_MAX_DECIMATION * (NUM_BLOCK_TYPES + 1))
+#define LOD_INDEX_TEXTURE_HEIGHT CHUNK_MAX_HEIGHT
+
+typedef struct LOD_CHUNK
+{
+    mat4 transform;
+    vec3 position;
+    unsigned int decimation, cells_per_side;
+    MODEL* model, *transparency_model;
+    INDEX_REGION index_region; // Where the index texture is in the index atlas
+    unsigned char* index_texture_data;
+    bool finalised; // Set once the models (and index texture) have been sent to the gpu
+    unsigned short heights[LOD_MAX_CELLS * LOD_MAX_CELLS]; // The height of the top of each cell, where row b and column a is at (b * cells_per_side) + a
+    BLOCK_TYPE tops[LOD_MAX_CELLS * LOD_MAX_CELLS], sides[LOD_MAX_CELLS * LOD_MAX_CELLS]; // The block on top of each cell, and the block its walls are made of
+} LOD_CHUNK;
+
+LOD_CHUNK* allocate_lod_chunk()
+{
+    LOD_CHUNK* to_return = calloc(1, sizeof(LOD_CHUNK));
+    to_return->model = make_quad_model(VERTEX_PACKED, LOD_MAX_CELLS * LOD_MAX_CELLS * 8);
+    to_return->transparency_model = make_quad_model(VERTEX_PACKED, LOD_MAX_CELLS * LOD_MAX_CELLS * 4);
+    if(block_texturing == BLOCK_TEXTURING_INDEX_TEXTURE) to_return->index_texture_data = calloc(LOD_INDEX_TEXTURE_WIDTH * LOD_INDEX_TEXTURE_HEIGHT, sizeof(unsigned char));
+    return to_return;
+}
+
+// Fills in the height, top block and wall block of every cell, from the terrain at the corner of the cell. These are exactly the same as the column
+// of the full chunk at that point, so distant terrain lines up with the chunks which replace it when they are generated
+void sample_lod_terrain(LOD_CHUNK* lod)
+{
+    unsigned int decimation = lod->decimation, cells = lod->cells_per_side;
+    float heights[CHUNK_SIZE * CHUNK_SIZE];
+    CLIMATE climate[LOD_MAX_CELLS * LOD_MAX_CELLS];
+    if(decimation >= terrain_lattice_step(CHUNK_SIZE))
+    {
+        // The cells are at least as far apart as the noise lattice, so the noise only needs to be evaluated at the cells themselves
+        float height_scales[TERRAIN_MAX_LATTICE_POINTS], height_offsets[TERRAIN_MAX_LATTICE_POINTS];
+        climate_height_lattice(height_scales, height_offsets, lod->position.x, -lod->position.z, cells, decimation);
+        terrain_height_lattice(heights, lod->position.x, -lod->position.z, height_scales, height_offsets, decimation, cells, TERRAIN_POINT_BLOCKS);
+    }
+    else
+    {
+        climate_terrain_heightmap(heights, lod->position.x, -lod->position.z, CHUNK_SIZE);
+        for(unsigned int b = 0; b < cells; b++)
+            for(unsigned int a = 0; a < cells; a++) heights[(b * cells) + a] = heights[(b * decimation * CHUNK_SIZE) + (a * decimation)];
+    }
+    sample_climate(climate, lod->position.x, -lod->position.z, cells, decimation);
+
+    for(unsigned int cell = 0; cell < cells * cells; cell++)
+    {
+        int stone_height, solid_height;
+        const BIOME_PALETTE* palette = biome_palettes + biome_from_climate(climate[cell]);
+        column_heights(heights[cell], &stone_height, &solid_height);
+        lod->sides[cell] = solid_height > stone_height ? palette->filler : STONE;
+        if(solid_height <= BASE_LEVEL + WATER_LEVEL)
+        {
+            lod->heights[cell] = BASE_LEVEL + WATER_LEVEL + 1;
+            lod->tops[cell] = WATER;
+        }
+        else
+        {
+            lod->heights[cell] = solid_height + 1;
+            lod->tops[cell] = palette->surface;
+        }
+    }
+}
+
+// The height just above the ground (or the water) at (x, -z) in the chunk at chunk_position, rounded down to even coordinates, without generating
+// the chunk. This is the same as the top of the column in the full chunk, other than any structures on it
+unsigned int lod_surface_height(vec3 chunk_position, unsigned int x, unsigned int z)
+{
+    LOD_CHUNK cells = { .position = chunk_position, .decimation = LOD_MIN_DECIMATION, .cells_per_side = LOD_MAX_CELLS };
+    sample_lod_terrain(&cells);
+    return cells.heights[((z / LOD_MIN_DECIMATION) * LOD_MAX_CELLS) + (x / LOD_MIN_DECIMATION)];
+}
+
+// Adds one face of a box of blocks to a model, with its texture indices starting at index_offset in the LOD chunk's index texture - or, with face layers,
+// textured all over with texture
+void lod_face(MODEL* to_fill, unsigned char face_index, vec3 position, vec3 size, vec2 index_offset, unsigned int texture)
+{
+    expand_chunk_model(to_fill, 32);
+    add_block_face(to_fill, face_index, position, size, block_texturing == BLOCK_TEXTURING_FACE_LAYERS ? v2(texture, 0) : index_offset);
+}
+
+// Builds the models and index texture for a LOD chunk from its cells
+void build_lod_model(LOD_CHUNK* lod)
+{
+    const unsigned char wall_faces[] = { 0, 1, 2, 3 }; // Front, back, left and right, in the same order as the neighbours below
+    const int neighbour_a[] = { 0, 0, -1, 1 }, neighbour_b[] = { -1, 1, 0, 0 };
+    unsigned int decimation = lod->decimation, cells = lod->cells_per_side;
+    lod->model->num_vertices = lod->model->num_indices = 0;
+    lod->transparency_model->num_vertices = lod->transparency_model->num_indices = 0;
+
+    // Every texel of a wall's strip is the side of its block, so that walls of any height and length can share it
+    bool index_texture = block_texturing == BLOCK_TEXTURING_INDEX_TEXTURE;
+    for(unsigned int type = 1; index_texture && type <= NUM_BLOCK_TYPES; type++)
+        for(unsigned int y = 0; y < LOD_INDEX_TEXTURE_HEIGHT; y++)
+            for(unsigned int x = 0; x < LOD_MAX_DECIMATION; x++)
+                lod->index_texture_data[(y * LOD_INDEX_TEXTURE_WIDTH) + CHUNK_SIZE + (type * LOD_MAX_DECIMATION) + x] = block_face_texture(type, 0);
+
+    for(unsigned int b = 0; b < cells; b++)
+    {
+        for(unsigned int a = 0; a < cells; a++)
+        {
+            unsigned int cell = (b * cells) + a, height = lod->heights[cell];
+            vec3 corner = v3(a * decimation, 0, -(float)(b * decimation));
+            for(unsigned int y = 0; index_texture && y < decimation; y++)
+                for(unsigned int x = 0; x < decimation; x++)
+                    lod->index_texture_data[(((b * decimation) + y) * LOD_INDEX_TEXTURE_WIDTH) + (a * decimation) + x] = block_face_texture(lod->tops[cell], 4);
+            lod_face(lod->tops[cell] == WATER ? lod->transparency_model : lod->model, 4, v3(corner.x, height - 1, corner.z), v3(decimation, 1, decimation), v2(a * decimation, b * decimation),
+                     block_face_texture(lod->tops[cell], 4));
+
+            // Walls go down to each lower neighbour, or hang down as a skirt at the edge of the chunk
+            for(unsigned int i = 0; i < 4; i++)
+            {
+                int next_a = a + neighbour_a[i], next_b = b + neighbour_b[i];
+                int bottom = height - (LOD_SKIRT_DEPTH * decimation);
+                if(next_a >= 0 && next_b >= 0 && next_a < (int)cells && next_b < (int)cells) bottom = lod->heights[(next_b * cells) + next_a];
+                if(bottom < 0) bottom = 0;
+                if(bottom >= (int)height) continue;
+                lod_face(lod->model, wall_faces[i], v3(corner.x, bottom, corner.z), v3(decimation, height - bottom, decimation), v2(CHUNK_SIZE + (lod->sides[cell] * LOD_MAX_DECIMATION), 0),
+                         block_face_texture(lod->sides[cell], 0));
+            }
+        }
+    }
+}
+
+// Generates a LOD chunk at position, with one cell for every decimation x decimation columns (2, 4 or 8). Optionally, pass an already allocated LOD chunk as place_into
+LOD_CHUNK* make_lod_chunk(vec3 position, unsigned int decimation, LOD_CHUNK* place_into)
+{
+    LOD_CHUNK* to_return = place_into;
+    if(!to_return) to_return = allocate_lod_chunk();
+    if(decimation < LOD_MIN_DECIMATION) decimation = LOD_MIN_DECIMATION;
+    if(decimation > LOD_MAX_DECIMATION) decimation = LOD_MAX_DECIMATION;
+    to_return->position = position;
+    to_return->transform = translate(position);
+    to_return->decimation = decimation;
+    to_return->cells_per_side = CHUNK_SIZE / decimation;
+    sample_lod_terrain(to_return);
+    build_lod_model(to_return);
+    return to_return;
+}
+
+void finalise_lod_chunk(LOD_CHUNK* to_finalise)
+{
+    finalise_model(to_finalise->model);
+    finalise_model(to_finalise->transparency_model);
+    to_finalise->finalised = true;
+    if(block_texturing != BLOCK_TEXTURING_INDEX_TEXTURE) return;
+    to_finalise->index_region = allocate_index_region(LOD_INDEX_TEXTURE_WIDTH, LOD_INDEX_TEXTURE_HEIGHT);
+    upload_index_region(to_finalise->index_region, to_finalise->index_texture_data, LOD_INDEX_TEXTURE_WIDTH, LOD_INDEX_TEXTURE_WIDTH, LOD_INDEX_TEXTURE_HEIGHT);
+}
+
+// Uploads a LOD chunk's models and index texture again after it has been generated again into a LOD chunk which was already finalised.
+// LOD chunks which haven't been finalised yet are finalised instead. Only call this from the thread which owns the opengl context
+void upload_lod_chunk(LOD_CHUNK* to_upload)
+{
+    if(!to_upload->finalised)
+    {
+        finalise_lod_chunk(to_upload);
+        return;
+    }
+    update_model(to_upload->model);
+    update_model(to_upload->transparency_model);
+    if(block_texturing == BLOCK_TEXTURING_INDEX_TEXTURE)
+        upload_index_region(to_upload->index_region, to_upload->index_texture_data, LOD_INDEX_TEXTURE_WIDTH, LOD_INDEX_TEXTURE_WIDTH, LOD_INDEX_TEXTURE_HEIGHT);
+}
+
+void render_lod_chunk(LOD_CHUNK* to_render)
+{
+    use_index_region(&(to_render->index_region));
+    set_shader_value(MODEL_MATRIX, &(to_render->transform));
+    glEnable(GL_CULL_FACE);
+    render_model(to_render->model);
+    glDisable(GL_CULL_FACE);
+    render_model(to_render->transparency_model);
+}
+
+void unload_lod_chunk(LOD_CHUNK* to_free)
+{
+    free_index_region(&(to_free->index_region));
+    unload_model(to_free->model);
+    unload_model(to_free->transparency_model);
+    free(to_free->model);
+    free(to_free->transparency_model);
+    free(to_free->index_texture_data);
+    free(to_free);
+}
+
+#endif
\ No newline at end of file
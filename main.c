@@ -6,15 +6,21 @@
 #include"os.h"
 #include"util.h"
 #include"noise.h"
+#include"random.h"
 #include"world.h"
+#include"save.h"
+#include"lod.h"
+#include"streaming.h"
 #include"camera.h"
 #include"shaders.h"
 
 typedef struct SETTINGS
 {
-    float fov, look_sensitivity, max_render_distance;
-    unsigned int window_width, window_height, chunk_buffer_size, num_threads_to_use;
-    bool invert_y_axis, show_fps, render_wireframe, render_sky;
+    float fov, look_sensitivity, max_render_distance, upload_milliseconds_per_frame;
+    unsigned int window_width, window_height, stream_radius, chunks_per_stage, upload_megabytes_per_frame, lod_radius, num_threads_to_use, terrain_lattice_step, terrain_octaves;
+    unsigned long long world_seed;
+    float terrain_lacunarity, terrain_gain;
+    bool invert_y_axis, show_fps, show_streaming_stats, render_wireframe, render_sky, ridged_terrain, density_terrain, binary_mesher, pull_chunk_faces, face_texture_layers;
 } SETTINGS;
 
 void resize_renderer(SETTINGS* settings, CAMERA* camera)
@@ -30,21 +36,6 @@ void switch_render_settings(SETTINGS* settings)
     else glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 }
 
-#ifdef _WIN32
-typedef struct CHUNK_FOR_MULTITHREADING
-{
-    vec3 position;
-    CHUNK* chunk;
-} CHUNK_FOR_MULTITHREADING;
-
-unsigned long generate_chunk_multithreaded(void* chunk_description)
-{
-    CHUNK_FOR_MULTITHREADING* description = (CHUNK_FOR_MULTITHREADING*)chunk_description;
-    make_chunk(description->position, description->chunk);
-    return 0;
-}
-#endif
-
 int main(int argc, char** argv)
 {
     /// Initialize SDL
@@ -60,9 +51,24 @@ int main(int argc, char** argv)
                           .show_fps = true,
                           .render_wireframe = false,
                           .max_render_distance = 500,
-                          .chunk_buffer_size = 1,
+                          .stream_radius = 1,
+                          .chunks_per_stage = 8,
+                          .upload_milliseconds_per_frame = 4.0f,
+                          .upload_megabytes_per_frame = 32,
+                          .show_streaming_stats = true,
+                          .lod_radius = 8,
                           .render_sky = true,
-                          .num_threads_to_use = 8
+                          .num_threads_to_use = 0, // 0 uses every core
+                          .world_seed = 0,
+                          .terrain_lattice_step = 4,
+                          .terrain_octaves = 4,
+                          .terrain_lacunarity = 2.0f,
+                          .terrain_gain = 0.5f,
+                          .ridged_terrain = false,
+                          .density_terrain = false,
+                          .binary_mesher = true, // The greedy mesher builds the same models, just more slowly
+                          .pull_chunk_faces = false, // Draws chunks and LOD chunks from one packed face per quad in a shader storage buffer, instead of four vertices
+                          .face_texture_layers = true // Puts each quad's texture in its vertices, instead of a 16 MB index texture for every chunk
                         };
     bool key_pressed[256] = { 0 };
 
@@ -99,43 +105,53 @@ int main(int argc, char** argv)
     glFrontFace(GL_CW);
 
     initialise_timer();
+    start_thread_pool(settings.num_threads_to_use);
     switch_render_settings(&settings);
 
     /// Setting up the rendering - temporary
-    // Load the vertex & fragment shaders
-    unsigned int blocks_shader_program = shader_program(BLOCK_VERTEX_SHADER, BLOCK_FRAGMENT_SHADER);
-    unsigned int debug_shader_program = shader_program(BLOCK_VERTEX_SHADER, DEBUG_FRAGMENT_SHADER);
+    // Load the vertex & fragment shaders. Blocks have different shaders when their faces are pulled or carry their texture layers, and these have to be chosen before any chunks are made
+    quad_rendering = settings.pull_chunk_faces ? QUAD_RENDERING_PULLED : QUAD_RENDERING_VERTICES;
+    block_texturing = settings.face_texture_layers ? BLOCK_TEXTURING_FACE_LAYERS : BLOCK_TEXTURING_INDEX_TEXTURE;
+    SHADER block_vertex_shader = quad_rendering == QUAD_RENDERING_PULLED ? BLOCK_PULLED_VERTEX_SHADER : BLOCK_VERTEX_SHADER;
+    unsigned int blocks_shader_program = shader_program(block_vertex_shader, block_texturing == BLOCK_TEXTURING_FACE_LAYERS ? BLOCK_LAYER_FRAGMENT_SHADER : BLOCK_FRAGMENT_SHADER);
+    unsigned int debug_shader_program = shader_program(block_vertex_shader, DEBUG_FRAGMENT_SHADER);
     unsigned int sky_shader_program = shader_program(SKY_VERTEX_SHADER, SKY_FRAGMENT_SHADER);
 
     // Create the terrain chunks and world elements
     load_block_textures();
-    init_noise(0);
-
-    // The chunks are generated into a buffer, and reassigned into a circular pattern, so that the memory only needs to be allocated once
-    initialize_chunk_buffer(settings.chunk_buffer_size);
-    
-    // The chunks are generated with multiple threads on operating systems where this is supported    
-    CHUNK_FOR_MULTITHREADING* chunks_to_generate = calloc(settings.chunk_buffer_size, sizeof(CHUNK_FOR_MULTITHREADING));
-    for(unsigned int i = 0; i < settings.chunk_buffer_size; i++)  
-    {
-        vec3 chunk_position = v3((float)((i % 3) * CHUNK_SIZE) - CHUNK_SIZE, 0, ((i / 3) * (float)-CHUNK_SIZE) + CHUNK_SIZE);
-        chunks_to_generate[i].chunk = chunks[i];
-        chunks_to_generate[i].position = chunk_position;
-    }
-
-    run_multithreaded(generate_chunk_multithreaded, chunks_to_generate, sizeof(CHUNK_FOR_MULTITHREADING), settings.chunk_buffer_size, settings.num_threads_to_use, true);
-    for(unsigned int i = 0; i < settings.chunk_buffer_size; i++) finalise_chunk(chunks[i]);
-    free(chunks_to_generate);
-
-    MODEL* sky_model = load_predefined_model(SKY_MODEL);
-
-    // Create and configure the camera
+    world_seed = settings.world_seed;
+    init_noise(world_seed);
+    init_biomes();
+    terrain_settings.lattice_step = settings.terrain_lattice_step;
+    terrain_settings.octaves = settings.terrain_octaves;
+    terrain_settings.lacunarity = settings.terrain_lacunarity;
+    terrain_settings.gain = settings.terrain_gain;
+    terrain_settings.ridged = settings.ridged_terrain;
+    terrain_settings.density_terrain = settings.density_terrain;
+    chunk_mesher = settings.binary_mesher ? CHUNK_MESHER_BINARY : CHUNK_MESHER_GREEDY;
+
+    // Chunks which were saved (or pre-generated with craftworlds-pregen) are loaded instead of being generated again
+    open_world_save(world_seed);
+    load_pending_writes();
+
+    // Configure the camera. The height of the spawn point comes straight from the terrain, so that nothing has to be generated before the first frame
     CAMERA player_camera = make_camera(PERSPECTIVE_PROJECTION, settings.window_width, settings.window_height, settings.fov);
-    vec3 initial_player_position = vec3_add_vec3(chunks[0]->position, vec3_add_vec3(top_cube(chunks[0], 10, -10), v3(0.0f, 2.8f, 0.0f)));
+    vec3 initial_player_position = v3(10.0f, lod_surface_height(v3(0, 0, 0), 10, 10) + 2.8f, -10.0f);
     // vec3 initial_player_position = v3(0, 0, 0);
     resize_renderer(&settings, &player_camera);
     move_camera(&player_camera, initial_player_position);
 
+    // The chunks are generated into a buffer, and reused for new chunks as the camera moves, so that the memory only needs to be allocated once.
+    // The chunks are generated in the background on the thread pool, and drawn from the first frame they are ready in
+    CHUNK_STREAMER* chunk_streamer = make_chunk_streamer(settings.stream_radius, settings.chunks_per_stage);
+    chunk_streamer->upload_time_budget = settings.upload_milliseconds_per_frame;
+    chunk_streamer->upload_byte_budget = (size_t)settings.upload_megabytes_per_frame * 1024 * 1024;
+
+    // Everything out to the LOD radius is drawn as LOD chunks wherever there isn't a chunk. A few are started each frame, so that they don't hold up the chunks around the camera
+    LOD_STREAMER* lod_streamer = make_lod_streamer(settings.lod_radius, settings.chunks_per_stage);
+
+    MODEL* sky_model = load_predefined_model(SKY_MODEL);
+
     float camera_speed = 10.0f;
     float camera_pitch_limit_bottom = 89.0f, camera_pitch_limit_top = -89.0f;
 
@@ -239,13 +255,28 @@ int main(int argc, char** argv)
         #ifdef DEBUG
         }
         #endif
-        for(unsigned int i = 0; i < settings.chunk_buffer_size; i++) render_chunk(chunks[i]);
+        update_streaming(chunk_streamer, &player_camera, elapsed_time);
+        upload_streamed_chunks(chunk_streamer);
+        update_lod_streaming(lod_streamer, &player_camera);
+        for(unsigned int i = 0; i < chunk_streamer->num_slots; i++)
+        {
+            STREAM_SLOT* slot = chunk_streamer->slots + i;
+            if(!slot->in_use || slot->stage != CHUNK_STAGE_DONE) continue;
+            render_chunk(slot->chunk);
+        }
+        render_streamed_lod_chunks(lod_streamer, chunk_streamer);
         SDL_GL_SwapWindow(window);
     }
 
     /// Cleanup
-    unload_chunk_buffer();
+    if(settings.show_streaming_stats) print_streaming_stats(chunk_streamer);
+    unload_chunk_streamer(chunk_streamer);
+    unload_lod_streamer(lod_streamer);
+    stop_thread_pool();
+    free_pending_writes();
     unload_model(sky_model);
+    unload_quad_indices();
+    unload_index_atlas();
     unload_shaders();
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -2,6 +2,8 @@
 #define NOISE_H
 
 extern void init_noise(long seed);
+extern double simplex_noise(double x, double y, double z);
+extern void simplex_noise_points(const double* x, const double* y, double z, double* values, unsigned int count);
 extern void simplex(unsigned char* img, unsigned int u, unsigned int v);
 
 #endif
\ No newline at end of file
@@ -35,6 +35,7 @@ void init_noise(long seed)
     short source[256];
     for(short i = 0; i < 256; i++) { source[i] = i; }
 
+    current_noise_seed = seed;
     current_noise_seed = current_noise_seed * 6364136223846793005 + 1442695040888963407;
 	current_noise_seed = current_noise_seed * 6364136223846793005 + 1442695040888963407;
 	current_noise_seed = current_noise_seed * 6364136223846793005 + 1442695040888963407;
@@ -52,13 +53,12 @@ void init_noise(long seed)
 	}
 }
 
-void simplex(unsigned char* img, unsigned int u, unsigned int v)
+// Returns the noise value at the given point, roughly in the range -1 to 1
+double simplex_noise(double x, double y, double z)
 {
     // This is a translation of the OpenSimplex algorithm from https://gist.github.com/KdotJPG/b1270127455a94ac5d19
-    double x = u * 0.2, y = (double)v * 0.2, z = 0.0;
-    
     //Place input coordinates on simplectic honeycomb.
-	double stretchOffset = (x + y + 0) * STRETCH_CONSTANT_3D;
+	double stretchOffset = (x + y + z) * STRETCH_CONSTANT_3D;
 	double xs = x + stretchOffset;
 	double ys = y + stretchOffset;
 	double zs = z + stretchOffset;
@@ -742,7 +742,19 @@ void simplex(unsigned char* img, unsigned int u, unsigned int v)
 		value += attn_ext1 * attn_ext1 * extrapolate(xsv_ext1, ysv_ext1, zsv_ext1, dx_ext1, dy_ext1, dz_ext1);
 	}
 	
-    value = ((value / NORM_CONSTANT_3D) + 1.0) / 2.0;
+    return value / NORM_CONSTANT_3D;
+}
+
+// Evaluates the noise at count points which share the same z coordinate, one after another, writing each result into values. This is only a loop over
+// simplex_noise, not a batched evaluation - it just lets the terrain hand over every lattice point still being refined for an octave at once
+void simplex_noise_points(const double* x, const double* y, double z, double* values, unsigned int count)
+{
+    for(unsigned int i = 0; i < count; i++) values[i] = simplex_noise(x[i], y[i], z);
+}
+
+void simplex(unsigned char* img, unsigned int u, unsigned int v)
+{
+    double value = (simplex_noise(u * 0.2, (double)v * 0.2, 0.0) + 1.0) / 2.0;
     char result = (char)(value * 255);
     unsigned char pixel[] = { result, result, result, 255 };
     memcpy(img, pixel, 4);
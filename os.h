@@ -1,29 +1,194 @@
 #ifndef OS_H
 #define OS_H
 #include<stdlib.h>
+#include<stdint.h>
 #include<stdbool.h>
-#ifdef _WIN32
-#define WIN32_LEAN_AND_MEAN
-#include<Windows.h>
-#define HANDLE_TYPE HANDLE
-#endif
-
-void run_multithreaded(unsigned long (*function_to_run)(void*), void* inputs, size_t size_of_each_input, unsigned int num_inputs, unsigned int num_threads_to_use, bool wait)
-{
-    unsigned int num_threads_in_use = 0;
-    HANDLE_TYPE* thread_handles = calloc(num_threads_to_use, sizeof(HANDLE_TYPE));
-    #ifdef _WIN32
-    DWORD thread_id;
-    for(unsigned int i = 0; i < num_inputs; i++)
+#include<pthread.h>
+#include<sched.h>
+#include<SDL2/SDL.h>
+
+#include"util.h"
+
+// A pool of worker threads which are started once and kept waiting for tasks. Each worker has its own deque of tasks - a worker adds the tasks it spawns
+// to the bottom of its own deque and takes its next task from there too (so it keeps working on what it just spawned, while it's still in the cache),
+// and once its deque is empty it steals from the top of the other workers' deques, where the oldest (usually biggest) tasks are.
+// Tasks spawned from threads outside the pool go into one more deque which every worker steals from.
+// Tasks are counted in wait groups, and a thread waiting on a group runs other tasks until the group is done, so tasks can spawn subtasks and wait on them
+#define TASK_DEQUE_SIZE 4096 // The most tasks each deque can hold - tasks spawned while a deque is full are run straight away instead
+
+typedef struct WAIT_GROUP
+{
+    SDL_atomic_t remaining; // The number of tasks in the group which haven't finished yet
+} WAIT_GROUP;
+
+typedef struct TASK
+{
+    void (*function)(void*);
+    void* data;
+    WAIT_GROUP* group;
+} TASK;
+
+typedef struct TASK_DEQUE
+{
+    pthread_mutex_t lock;
+    unsigned int top, bottom; // Both only ever count up - the tasks in the deque are the ones from top up to (but not including) bottom, wrapped around the array
+    TASK tasks[TASK_DEQUE_SIZE];
+} TASK_DEQUE;
+
+typedef struct THREAD_POOL
+{
+    unsigned int num_workers;
+    pthread_t* workers;
+    TASK_DEQUE* deques; // One for each worker, then the one for tasks spawned from outside the pool
+    SDL_atomic_t queued_tasks;
+    pthread_mutex_t sleep_lock; // Workers with nothing to do sleep on wake until a task is spawned
+    pthread_cond_t wake;
+    bool stopping;
+} THREAD_POOL;
+
+THREAD_POOL thread_pool = { 0 };
+__thread int current_worker = -1; // The index of the worker running on this thread, or -1 for threads outside the pool
+
+// The index of the calling thread in the pool, from 0 up to the number of workers - every thread outside the pool gets the number of workers.
+// This is useful for giving each worker its own memory to work in
+unsigned int thread_pool_worker_index() { return current_worker < 0 ? thread_pool.num_workers : (unsigned int)current_worker; }
+
+bool pop_task(TASK_DEQUE* deque, TASK* task, bool from_top)
+{
+    bool found = false;
+    pthread_mutex_lock(&(deque->lock));
+    if(deque->top != deque->bottom)
     {
-        thread_handles[num_threads_in_use++] = CreateThread(NULL, 0, function_to_run, (char*)inputs + (i * size_of_each_input), 0, &thread_id);
-        if(num_threads_in_use == num_threads_to_use || (i == num_inputs - 1 && wait))
+        *task = from_top ? deque->tasks[deque->top++ % TASK_DEQUE_SIZE] : deque->tasks[--deque->bottom % TASK_DEQUE_SIZE];
+        found = true;
+    }
+    pthread_mutex_unlock(&(deque->lock));
+    return found;
+}
+
+// Takes the next task for the calling thread - from the bottom of its own deque if it has one, otherwise from the top of any other deque, starting with the next worker's
+bool take_task(TASK* task)
+{
+    unsigned int own = thread_pool_worker_index(), num_deques = thread_pool.num_workers + 1;
+    if(current_worker >= 0 && pop_task(thread_pool.deques + own, task, false))
+    {
+        SDL_AtomicAdd(&(thread_pool.queued_tasks), -1);
+        return true;
+    }
+    for(unsigned int i = 1; i <= num_deques; i++)
+    {
+        TASK_DEQUE* victim = thread_pool.deques + ((own + i) % num_deques);
+        if(victim == thread_pool.deques + own && current_worker >= 0) continue;
+        if(!pop_task(victim, task, true)) continue;
+        SDL_AtomicAdd(&(thread_pool.queued_tasks), -1);
+        return true;
+    }
+    return false;
+}
+
+void run_task(TASK* task)
+{
+    task->function(task->data);
+    if(task->group) SDL_AtomicAdd(&(task->group->remaining), -1);
+}
+
+void* thread_pool_worker(void* worker_index)
+{
+    current_worker = (int)(intptr_t)worker_index;
+    TASK task;
+    while(true)
+    {
+        if(take_task(&task))
         {
-            WaitForMultipleObjects(num_threads_in_use, thread_handles, TRUE, INFINITE);
-            num_threads_in_use = 0;
+            run_task(&task);
+            continue;
         }
+
+        // Spawning a task signals wake with sleep_lock held, after the task is counted, so checking the count under the lock can't miss a wake up
+        pthread_mutex_lock(&(thread_pool.sleep_lock));
+        while(!SDL_AtomicGet(&(thread_pool.queued_tasks)) && !thread_pool.stopping) pthread_cond_wait(&(thread_pool.wake), &(thread_pool.sleep_lock));
+        bool stop = thread_pool.stopping && !SDL_AtomicGet(&(thread_pool.queued_tasks));
+        pthread_mutex_unlock(&(thread_pool.sleep_lock));
+        if(stop) return NULL;
+    }
+}
+
+// Starts the worker threads. Passing 0 for num_workers starts one for every core. Until the pool is started, spawned tasks are run straight away
+void start_thread_pool(unsigned int num_workers)
+{
+    if(!num_workers) num_workers = SDL_GetCPUCount() > 0 ? SDL_GetCPUCount() : 1;
+    thread_pool.num_workers = num_workers;
+    thread_pool.workers = calloc(num_workers, sizeof(pthread_t));
+    thread_pool.deques = calloc(num_workers + 1, sizeof(TASK_DEQUE));
+    if(!thread_pool.workers || !thread_pool.deques) exit_with_error("Memory allocation error", "calloc() failed while starting the thread pool");
+    for(unsigned int i = 0; i <= num_workers; i++) pthread_mutex_init(&(thread_pool.deques[i].lock), NULL);
+    pthread_mutex_init(&(thread_pool.sleep_lock), NULL);
+    pthread_cond_init(&(thread_pool.wake), NULL);
+    for(unsigned int i = 0; i < num_workers; i++)
+        if(pthread_create(thread_pool.workers + i, NULL, thread_pool_worker, (void*)(intptr_t)i)) exit_with_error("Could not start the thread pool", "pthread_create() failed");
+}
+
+// Spawns a task which runs function(data) on one of the workers, counting it in group if group isn't NULL
+void spawn_task(WAIT_GROUP* group, void (*function)(void*), void* data)
+{
+    TASK task = { .function = function, .data = data, .group = group };
+    if(group) SDL_AtomicAdd(&(group->remaining), 1);
+    if(!thread_pool.num_workers)
+    {
+        run_task(&task);
+        return;
+    }
+
+    TASK_DEQUE* deque = thread_pool.deques + thread_pool_worker_index();
+    pthread_mutex_lock(&(deque->lock));
+    bool full = deque->bottom - deque->top == TASK_DEQUE_SIZE;
+    if(!full) deque->tasks[deque->bottom++ % TASK_DEQUE_SIZE] = task;
+    pthread_mutex_unlock(&(deque->lock));
+    if(full)
+    {
+        run_task(&task);
+        return;
+    }
+
+    SDL_AtomicAdd(&(thread_pool.queued_tasks), 1);
+    pthread_mutex_lock(&(thread_pool.sleep_lock));
+    pthread_cond_signal(&(thread_pool.wake));
+    pthread_mutex_unlock(&(thread_pool.sleep_lock));
+}
+
+// Returns once every task in the group has finished, running other tasks in the meantime
+void wait_for_group(WAIT_GROUP* group)
+{
+    TASK task;
+    while(SDL_AtomicGet(&(group->remaining)))
+    {
+        if(take_task(&task)) run_task(&task);
+        else sched_yield();
     }
-    #endif
-    free(thread_handles);
+}
+
+// Runs function once for each of the inputs, which are size_of_each_input bytes apart, spread over the pool, and waits for them all to finish
+void run_multithreaded(void (*function_to_run)(void*), void* inputs, size_t size_of_each_input, unsigned int num_inputs)
+{
+    WAIT_GROUP group = { 0 };
+    for(unsigned int i = 0; i < num_inputs; i++) spawn_task(&group, function_to_run, (char*)inputs + (i * size_of_each_input));
+    wait_for_group(&group);
+}
+
+// Finishes the tasks which are still queued, then stops the workers
+void stop_thread_pool()
+{
+    if(!thread_pool.num_workers) return;
+    pthread_mutex_lock(&(thread_pool.sleep_lock));
+    thread_pool.stopping = true;
+    pthread_cond_broadcast(&(thread_pool.wake));
+    pthread_mutex_unlock(&(thread_pool.sleep_lock));
+    for(unsigned int i = 0; i < thread_pool.num_workers; i++) pthread_join(thread_pool.workers[i], NULL);
+    for(unsigned int i = 0; i <= thread_pool.num_workers; i++) pthread_mutex_destroy(&(thread_pool.deques[i].lock));
+    pthread_mutex_destroy(&(thread_pool.sleep_lock));
+    pthread_cond_destroy(&(thread_pool.wake));
+    free(thread_pool.workers);
+    free(thread_pool.deques);
+    thread_pool = (THREAD_POOL){ 0 };
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,157 @@
+#ifndef PENDING_WRITES_H
+#define PENDING_WRITES_H
+#include<stdlib.h>
+#include<string.h>
+#include<SDL2/SDL.h>
+
+#include"util.h"
+#include"blocks.h"
+
+// Structures which spill over the edge of the chunk they are placed in leave the blocks outside of it here, keyed by the chunk they belong to, and the
+// blocks are written into that chunk once it is generated. Everything is pushed onto lists with compare-and-swap rather than behind a lock, so that threads
+// generating neighbouring chunks never wait on each other. A chunk remembers how much of its list it has already applied, and once it has applied them,
+// the older writes are folded into one (see compact_pending_writes) - they are kept rather than freed, so that a chunk which is unloaded and generated
+// again gets all of its blocks back
+#define PENDING_WRITES_BUCKETS 1024 // The number of lists the chunks are spread over - more buckets means shorter lists to search through
+
+typedef struct PENDING_BLOCK
+{
+    unsigned char x, y, z; // The position of the block within its chunk, with z going away from the front of the chunk (the same as the cube array)
+    unsigned char type; // A BLOCK_TYPE, kept to a single byte since structures can leave a lot of these
+} PENDING_BLOCK;
+
+// All of the blocks one structure spilled into one chunk, which are added in a single step
+typedef struct PENDING_WRITE
+{
+    struct PENDING_WRITE* next;
+    unsigned int num_blocks;
+    PENDING_BLOCK blocks[];
+} PENDING_WRITE;
+
+typedef struct PENDING_CHUNK
+{
+    struct PENDING_CHUNK* next;
+    int chunk_x, chunk_z;
+    void* writes; // The newest PENDING_WRITE for the chunk, which links back to the older ones
+    SDL_atomic_t generated, dirty; // Once the chunk is generated, anything added to it marks it dirty so that whoever owns the chunk can apply it
+} PENDING_CHUNK;
+
+void* pending_chunks[PENDING_WRITES_BUCKETS];
+
+// Where structures overlap, the block with the higher priority is kept, so the result is the same whatever order the structures are placed in - which
+// isn't known, since blocks spill in from neighbouring chunks whenever the threads generating them get to it. Leaves only grow into empty space, structures'
+// solid blocks replace the terrain and leaves beneath them, and nothing replaces water
+const unsigned char structure_block_priority[] = { [EMPTY] = 0, [LEAVES] = 1, [GRASS] = 2, [SOIL] = 3, [STONE] = 4, [WOOD] = 5, [WOOD_TOP] = 6, [WATER] = 7 };
+
+unsigned int pending_bucket(int chunk_x, int chunk_z) { return ((unsigned int)chunk_x * 73856093u ^ (unsigned int)chunk_z * 19349663u) % PENDING_WRITES_BUCKETS; }
+
+// Returns the entry for a chunk, adding it if it isn't there yet. If another thread adds an entry to the same bucket first, the bucket is searched again
+// from its new start, since that entry may well be for the same chunk
+PENDING_CHUNK* find_pending_chunk(int chunk_x, int chunk_z)
+{
+    void** bucket = pending_chunks + pending_bucket(chunk_x, chunk_z);
+    PENDING_CHUNK* to_add = NULL;
+    while(true)
+    {
+        PENDING_CHUNK* first = SDL_AtomicGetPtr(bucket);
+        for(PENDING_CHUNK* pending = first; pending; pending = pending->next)
+        {
+            if(pending->chunk_x != chunk_x || pending->chunk_z != chunk_z) continue;
+            free(to_add);
+            return pending;
+        }
+
+        if(!to_add && !(to_add = calloc(1, sizeof(PENDING_CHUNK)))) exit_with_error("Memory allocation error", "calloc() failed while adding a chunk to the pending writes");
+        to_add->chunk_x = chunk_x;
+        to_add->chunk_z = chunk_z;
+        to_add->next = first;
+        if(SDL_AtomicCASPtr(bucket, first, to_add)) return to_add;
+    }
+}
+
+// Adds blocks to a chunk's pending writes (the blocks are copied). If the chunk has already been generated, it is marked dirty as well
+void add_pending_write(int chunk_x, int chunk_z, const PENDING_BLOCK* blocks, unsigned int num_blocks)
+{
+    PENDING_CHUNK* pending = find_pending_chunk(chunk_x, chunk_z);
+    PENDING_WRITE* write = malloc(sizeof(PENDING_WRITE) + num_blocks * sizeof(PENDING_BLOCK));
+    if(!write) exit_with_error("Memory allocation error", "malloc() failed while adding pending writes");
+    write->num_blocks = num_blocks;
+    memcpy(write->blocks, blocks, num_blocks * sizeof(PENDING_BLOCK));
+    do write->next = SDL_AtomicGetPtr(&pending->writes);
+    while(!SDL_AtomicCASPtr(&pending->writes, write->next, write));
+
+    // The chunk checks for writes again after it is marked as generated, so anything added before this point is picked up either way
+    if(SDL_AtomicGet(&pending->generated)) SDL_AtomicSet(&pending->dirty, 1);
+}
+
+int compare_pending_blocks(const void* a, const void* b) // Internal
+{
+    const PENDING_BLOCK* first = a, *second = b;
+    if(first->y != second->y) return first->y - second->y;
+    if(first->z != second->z) return first->z - second->z;
+    return first->x - second->x;
+}
+
+// Folds every write older than newest into a single write, with one block per position (the one with the highest priority, which is what placing them
+// all would leave). newest itself is kept, since other threads may be linking new writes to it. Only the thread which owns the chunk may call this,
+// once it has applied everything up to newest
+void compact_pending_writes(PENDING_WRITE* newest)
+{
+    unsigned int num_writes = 0, num_blocks = 0;
+    for(PENDING_WRITE* write = newest->next; write; write = write->next, num_writes++) num_blocks += write->num_blocks;
+    if(num_writes < 2) return;
+
+    PENDING_WRITE* folded = malloc(sizeof(PENDING_WRITE) + num_blocks * sizeof(PENDING_BLOCK));
+    if(!folded) exit_with_error("Memory allocation error", "malloc() failed while folding pending writes");
+    folded->next = NULL;
+    folded->num_blocks = 0;
+    for(PENDING_WRITE* write = newest->next; write; write = write->next)
+    {
+        memcpy(folded->blocks + folded->num_blocks, write->blocks, write->num_blocks * sizeof(PENDING_BLOCK));
+        folded->num_blocks += write->num_blocks;
+    }
+    qsort(folded->blocks, num_blocks, sizeof(PENDING_BLOCK), compare_pending_blocks);
+    folded->num_blocks = 0;
+    for(unsigned int i = 0; i < num_blocks; i++)
+    {
+        PENDING_BLOCK* last = folded->num_blocks ? folded->blocks + folded->num_blocks - 1 : NULL;
+        if(!last || compare_pending_blocks(last, folded->blocks + i)) folded->blocks[folded->num_blocks++] = folded->blocks[i];
+        else if(structure_block_priority[folded->blocks[i].type] > structure_block_priority[last->type]) last->type = folded->blocks[i].type;
+    }
+    PENDING_WRITE* shrunk = realloc(folded, sizeof(PENDING_WRITE) + folded->num_blocks * sizeof(PENDING_BLOCK));
+    if(shrunk) folded = shrunk;
+
+    PENDING_WRITE* write = newest->next;
+    newest->next = folded;
+    while(write)
+    {
+        PENDING_WRITE* next_write = write->next;
+        free(write);
+        write = next_write;
+    }
+}
+
+// Only call this once no other threads are using the pending writes
+void free_pending_writes()
+{
+    for(unsigned int i = 0; i < PENDING_WRITES_BUCKETS; i++)
+    {
+        PENDING_CHUNK* pending = pending_chunks[i];
+        while(pending)
+        {
+            PENDING_CHUNK* next_chunk = pending->next;
+            PENDING_WRITE* write = pending->writes;
+            while(write)
+            {
+                PENDING_WRITE* next_write = write->next;
+                free(write);
+                write = next_write;
+            }
+            free(pending);
+            pending = next_chunk;
+        }
+        pending_chunks[i] = NULL;
+    }
+}
+
+#endif
\ No newline at end of file
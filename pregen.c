@@ -0,0 +1,228 @@
+#define SDL_MAIN_HANDLED
+#include<stdio.h>
+#include<stdlib.h>
+#include<stdbool.h>
+#include<SDL2/SDL.h>
+
+#include"os.h"
+#include"util.h"
+#include"noise.h"
+#include"random.h"
+#include"world.h"
+#include"save.h"
+
+// Generates every chunk within a radius of the origin and saves it, without opening a window, so that a world can be played without waiting for it to generate.
+// The chunks are generated on the thread pool, one task per row which spawns a task for each chunk in it. Structures can spill into chunks which were
+// already saved, so once everything is generated, the chunks which got blocks after they were saved are loaded (which places those blocks) and saved again.
+// With --verify-determinism nothing is saved - the area is generated twice, once on a single thread and once on all of them, and the chunks are compared instead
+typedef struct PREGEN_STATE
+{
+    int radius;
+    unsigned int side, num_chunks;
+    bool resaving;
+    bool verifying, hashing; // Whether chunks are only generated rather than saved, and whether they are being generated again to be hashed
+    unsigned long long* hashes; // The hash of each chunk once every neighbour's blocks are in it, while verifying
+    SDL_atomic_t chunks_done, chunks_failed;
+    CHUNK** chunks; // One for each worker to generate into, plus one for the main thread
+    PENDING_WRITE** saved_writes; // The newest pending write each chunk had applied when it was saved
+    WAIT_GROUP group;
+} PREGEN_STATE;
+
+PREGEN_STATE pregen_state = { 0 };
+
+vec3 pregen_chunk_position(PREGEN_STATE* state, unsigned int index) { return v3(((int)(index % state->side) - state->radius) * CHUNK_SIZE, 0, ((int)(index / state->side) - state->radius) * CHUNK_SIZE); }
+
+void pregen_chunk(void* chunk_index)
+{
+    PREGEN_STATE* state = &pregen_state;
+    unsigned int index = (unsigned int)(intptr_t)chunk_index;
+    CHUNK* chunk = state->chunks[thread_pool_worker_index()];
+    vec3 position = pregen_chunk_position(state, index);
+    bool saved;
+    if(state->verifying)
+    {
+        // By the second time round, every neighbour has spilled its blocks, so the chunk is complete
+        make_chunk(position, chunk);
+        if(state->hashing) state->hashes[index] = chunk_hash(chunk);
+        SDL_AtomicAdd(&(state->chunks_done), 1);
+        return;
+    }
+    if(!state->resaving)
+    {
+        make_chunk(position, chunk);
+        state->saved_writes[index] = chunk->applied_writes;
+        saved = save_chunk(chunk);
+    }
+    else
+    {
+        // Chunks nothing has spilled into since they were saved are already up to date, and count as done without saving them again
+        PENDING_CHUNK* pending = find_pending_chunk(chunk_coordinate(position.x), chunk_coordinate(position.z));
+        saved = SDL_AtomicGetPtr(&(pending->writes)) == state->saved_writes[index] || (load_chunk(position, chunk) && save_chunk(chunk));
+    }
+    if(!saved) SDL_AtomicAdd(&(state->chunks_failed), 1);
+    SDL_AtomicAdd(&(state->chunks_done), 1);
+}
+
+void pregen_row(void* row_index)
+{
+    unsigned int row = (unsigned int)(intptr_t)row_index;
+    for(unsigned int i = 0; i < pregen_state.side; i++) spawn_task(&(pregen_state.group), pregen_chunk, (void*)(intptr_t)(row * pregen_state.side + i));
+}
+
+// Runs every chunk through the pool, printing how quickly the chunks are being finished until they all are. Returns the number of chunks finished
+unsigned int run_pregen_tasks(PREGEN_STATE* state, const char* action)
+{
+    SDL_AtomicSet(&(state->chunks_done), 0);
+    Uint64 start_time = SDL_GetPerformanceCounter();
+    for(unsigned int row = 0; row < state->side; row++) spawn_task(&(state->group), pregen_row, (void*)(intptr_t)row);
+
+    Uint64 last_report_time = start_time;
+    while(SDL_AtomicGet(&(state->group.remaining)))
+    {
+        SDL_Delay(20);
+        if(SDL_GetPerformanceCounter() - last_report_time < SDL_GetPerformanceFrequency() / 2) continue;
+        last_report_time = SDL_GetPerformanceCounter();
+        double elapsed_time = (double)(last_report_time - start_time) / SDL_GetPerformanceFrequency();
+        unsigned int chunks_done = SDL_AtomicGet(&(state->chunks_done));
+        printf("\r%s: %u of %u chunks (%.1lf chunks per second)   ", action, chunks_done, state->num_chunks, chunks_done / elapsed_time);
+        fflush(stdout);
+    }
+    wait_for_group(&(state->group));
+
+    double elapsed_time = (double)(SDL_GetPerformanceCounter() - start_time) / SDL_GetPerformanceFrequency();
+    unsigned int chunks_done = SDL_AtomicGet(&(state->chunks_done));
+    printf("\r%s: %u chunks in %.2lf seconds (%.1lf chunks per second)   \n", action, chunks_done, elapsed_time, chunks_done / elapsed_time);
+    return chunks_done;
+}
+
+// Times how long each mesher takes to build the models of the chunks which were just saved, on the main thread - every chunk is built by each mesher in turn,
+// so they all see the same blocks. The chunks are loaded without their neighbours, so the faces at their edges are all kept
+void benchmark_meshers(PREGEN_STATE* state)
+{
+    CHUNK* chunk = state->chunks[thread_pool.num_workers];
+    CHUNK_MESHER original_mesher = chunk_mesher;
+    double mesh_times[NUM_CHUNK_MESHERS] = { 0 };
+    unsigned long long num_quads[NUM_CHUNK_MESHERS] = { 0 };
+    unsigned int num_chunks = 0;
+    for(unsigned int index = 0; index < state->num_chunks; index++)
+    {
+        if(!load_chunk(pregen_chunk_position(state, index), chunk)) continue;
+        num_chunks++;
+        for(unsigned int mesher = 0; mesher < NUM_CHUNK_MESHERS; mesher++)
+        {
+            chunk_mesher = mesher;
+            Uint64 start_time = SDL_GetPerformanceCounter();
+            build_chunk_model(chunk);
+            mesh_times[mesher] += (double)(SDL_GetPerformanceCounter() - start_time) / SDL_GetPerformanceFrequency();
+            num_quads[mesher] += (chunk->model->num_indices + chunk->transparency_model->num_indices) / 6;
+        }
+    }
+    chunk_mesher = original_mesher;
+
+    for(unsigned int mesher = 0; mesher < NUM_CHUNK_MESHERS; mesher++)
+        printf("%s mesher: %u chunks in %.2lf seconds (%.1lf chunks per second), %llu quads\n", chunk_mesher_names[mesher], num_chunks, mesh_times[mesher],
+               mesh_times[mesher] > 0 ? num_chunks / mesh_times[mesher] : 0.0, num_quads[mesher]);
+    if(mesh_times[CHUNK_MESHER_BINARY] > 0)
+        printf("The binary mesher builds chunks %.2lf times as fast as the greedy mesher\n", mesh_times[CHUNK_MESHER_GREEDY] / mesh_times[CHUNK_MESHER_BINARY]);
+}
+
+// Makes a chunk for each worker to generate into, plus one for the main thread
+void allocate_pregen_chunks(PREGEN_STATE* state)
+{
+    state->chunks = calloc(thread_pool.num_workers + 1, sizeof(CHUNK*));
+    for(unsigned int i = 0; i <= thread_pool.num_workers; i++) state->chunks[i] = allocate_chunk_memory();
+}
+
+void free_pregen_chunks(PREGEN_STATE* state)
+{
+    for(unsigned int i = 0; i <= thread_pool.num_workers; i++) unload_chunk(state->chunks[i]);
+    free(state->chunks);
+    state->chunks = NULL;
+}
+
+// Generates the area and then generates it all again, hashing each chunk, using num_threads threads. Everything is cleared out afterwards, so it can be run again
+void hash_pregen_area(PREGEN_STATE* state, unsigned int num_threads, unsigned long long* hashes)
+{
+    start_thread_pool(num_threads);
+    allocate_pregen_chunks(state);
+    printf("Generating %u chunks using %u threads\n", state->num_chunks, thread_pool.num_workers);
+    state->hashes = hashes;
+    state->hashing = false;
+    run_pregen_tasks(state, "Generated");
+    state->hashing = true;
+    run_pregen_tasks(state, "Hashed");
+    free_pregen_chunks(state);
+    stop_thread_pool();
+    free_pending_writes();
+}
+
+// Checks that the chunks come out the same on one thread as on many, whatever order they happen to be generated in. Returns the number of chunks which differ
+unsigned int verify_determinism(PREGEN_STATE* state, unsigned int num_threads)
+{
+    unsigned long long* single_thread_hashes = calloc(state->num_chunks, sizeof(unsigned long long)), *hashes = calloc(state->num_chunks, sizeof(unsigned long long));
+    if(!single_thread_hashes || !hashes) exit_with_error("Memory allocation error", "calloc() failed while allocating the chunk hashes");
+    state->verifying = true;
+    hash_pregen_area(state, 1, single_thread_hashes);
+    hash_pregen_area(state, num_threads, hashes);
+
+    unsigned int num_different = 0;
+    for(unsigned int index = 0; index < state->num_chunks; index++)
+    {
+        if(hashes[index] == single_thread_hashes[index]) continue;
+        vec3 position = pregen_chunk_position(state, index);
+        printf("Chunk (%d, %d) differs: %016llx on one thread, %016llx on many\n", chunk_coordinate(position.x), chunk_coordinate(position.z), single_thread_hashes[index], hashes[index]);
+        num_different++;
+    }
+    if(num_different) printf("%u of %u chunks differ between one thread and many\n", num_different, state->num_chunks);
+    else printf("All %u chunks are the same on one thread as on many\n", state->num_chunks);
+    free(single_thread_hashes);
+    free(hashes);
+    return num_different;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 3) exit_with_error("Could not start pre-generation", "usage: craftworlds-pregen <seed> <radius in chunks> [number of threads] [--density] [--benchmark-meshers] [--verify-determinism]");
+
+    PREGEN_STATE* state = &pregen_state;
+    unsigned int num_threads = 0;
+    bool benchmarking_meshers = false, verifying_determinism = false;
+    state->radius = atoi(argv[2]);
+    if(state->radius < 0) exit_with_error("Could not start pre-generation", "the radius can't be negative");
+    for(int i = 3; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "--density")) terrain_settings.density_terrain = true;
+        else if(!strcmp(argv[i], "--benchmark-meshers")) benchmarking_meshers = true;
+        else if(!strcmp(argv[i], "--verify-determinism")) verifying_determinism = true;
+        else if(atoi(argv[i]) > 0) num_threads = atoi(argv[i]);
+    }
+
+    SDL_SetMainReady();
+    world_seed = strtoull(argv[1], NULL, 10);
+    init_noise(world_seed);
+    init_biomes();
+    state->side = state->radius * 2 + 1;
+    state->num_chunks = state->side * state->side;
+    if(verifying_determinism) return verify_determinism(state, num_threads) ? 1 : 0;
+
+    open_world_save(world_seed);
+    start_thread_pool(num_threads);
+    state->saved_writes = calloc(state->num_chunks, sizeof(PENDING_WRITE*));
+    allocate_pregen_chunks(state);
+    printf("Pre-generating %u chunks for seed %llu into %s, using %u threads\n", state->num_chunks, world_seed, world_save_directory, thread_pool.num_workers);
+
+    run_pregen_tasks(state, "Generated");
+    state->resaving = true;
+    run_pregen_tasks(state, "Added spilled blocks to");
+    if(!save_pending_writes(-state->radius, -state->radius, state->radius, state->radius))
+        exit_with_error("Could not save the world", "the pending writes file couldn't be written");
+    if(SDL_AtomicGet(&(state->chunks_failed)))
+        fprintf(stderr, "%d chunks could not be saved\n", SDL_AtomicGet(&(state->chunks_failed)));
+    if(benchmarking_meshers) benchmark_meshers(state);
+
+    free_pregen_chunks(state);
+    stop_thread_pool();
+    free(state->saved_writes);
+    free_pending_writes();
+    return SDL_AtomicGet(&(state->chunks_failed)) ? 1 : 0;
+}
\ No newline at end of file
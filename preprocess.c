@@ -1,12 +1,15 @@
 #include<stdio.h>
 #include<string.h>
+#include<math.h>
 
 #include"util.h"
 #include"blocks.h"
+#include"random.h"
 
 #define ONLY_INCLUDE_DEFINITIONS
 #include"shaders.h"
 #include"rendering.h"
+#include"structures.h"
 
 unsigned char* stbi_load_from_file(FILE*, int*, int*, int*, int);
 void stbi_image_free(void*);
@@ -15,7 +18,7 @@ int main(int argc, char** argv)
 {
     FILE* asset_file;
     char asset_file_to_open[512] = { 0 };
-    if(argc < 2) exit_with_error("Could not start preprocessor", "need at least another argument (type of processing to do): either --images or --shaders");
+    if(argc < 2) exit_with_error("Could not start preprocessor", "need at least another argument (type of processing to do): either --images, --shaders, --models or --structures");
 
     if(!strcmp(argv[1], "--images"))
     {
@@ -142,4 +145,74 @@ int main(int argc, char** argv)
         free(vertex_positions);
         free(face_indices);
     }
+    else if(!strcmp(argv[1], "--structures"))
+    {
+        // Structures: build every variant of every type of structure as a template of blocks, then write them all out one after another.
+        // The variants are made with the world generation random numbers (keyed by the structure type and variant rather than a chunk), so they are always the same
+        unsigned long structure_offsets[NUM_STRUCTURES] = { 0 }, structure_data_length = 0, template_size;
+        unsigned char* structure_data = calloc(NUM_STRUCTURES, sizeof(STRUCTURE_TEMPLATE) + STRUCTURE_MAX_SIZE * STRUCTURE_MAX_SIZE * STRUCTURE_MAX_SIZE);
+        unsigned int structure_index = 0;
+        for(unsigned int type = 0; type < NUM_STRUCTURE_TYPES; type++)
+        {
+            for(unsigned int variant = 0; variant < structure_variants[type]; variant++, structure_index++)
+            {
+                STRUCTURE_TEMPLATE* template = (STRUCTURE_TEMPLATE*)(structure_data + structure_data_length);
+                unsigned int trunk_height = 3 + variant % 4;
+                float centre_y = 1, radius = 0, half_height = type == TREE_STRUCTURE ? 1.0f : 2.0f;
+                BLOCK_TYPE fill_type = LEAVES;
+                if(type == TREE_STRUCTURE)
+                {
+                    // A trunk with a cap of leaves around the top of it, which gets sparser further from the top
+                    template->width = 7; template->depth = 7; template->height = trunk_height + 2;
+                    template->anchor_x = 3; template->anchor_z = 3;
+                    centre_y = trunk_height; radius = 3.0f;
+                    template->blocks[3 + (3 * 7)] = SOIL;
+                    for(unsigned int y = 1; y < trunk_height; y++) template->blocks[3 + (3 * 7) + (y * 7 * 7)] = WOOD;
+                    template->blocks[3 + (3 * 7) + (trunk_height * 7 * 7)] = WOOD_TOP;
+                }
+                else if(type == BUSH_STRUCTURE)
+                {
+                    // A small clump of leaves sitting on the ground
+                    template->width = 5; template->depth = 5; template->height = 3;
+                    template->anchor_x = 2; template->anchor_z = 2;
+                    radius = 2.0f + (variant % 2) * 0.4f;
+                }
+                else if(type == BOULDER_STRUCTURE)
+                {
+                    // A lump of stone, partly sunk into the ground
+                    template->width = 5; template->depth = 5; template->height = 4;
+                    template->anchor_x = 2; template->anchor_z = 2;
+                    radius = 2.2f + variant * 0.25f;
+                    fill_type = STONE;
+                }
+
+                // Fill in the blob of leaves or stone, always where it's close to the centre, and with a falling chance further out than that
+                for(unsigned int y = 0; y < template->height; y++)
+                {
+                    for(unsigned int z = 0; z < template->depth; z++)
+                    {
+                        for(unsigned int x = 0; x < template->width; x++)
+                        {
+                            unsigned int index = x + (z * template->width) + (y * template->width * template->depth);
+                            float x_pos = (float)x - template->anchor_x, y_pos = (float)y - centre_y, z_pos = (float)z - template->anchor_z;
+                            float distance = sqrtf(x_pos * x_pos + y_pos * y_pos + z_pos * z_pos);
+                            if(template->blocks[index] == EMPTY && (y > 0 || type == BOULDER_STRUCTURE) && fabsf(y_pos) <= half_height && random_float(type, variant, FEATURE_STRUCTURE_SHAPE, index) < radius - distance)
+                                template->blocks[index] = fill_type;
+                        }
+                    }
+                }
+
+                template_size = sizeof(STRUCTURE_TEMPLATE) + (template->width * template->height * template->depth);
+                structure_offsets[structure_index] = (NUM_STRUCTURES * sizeof(unsigned long)) + structure_data_length;
+                structure_data_length += template_size;
+            }
+        }
+
+        strcpy(asset_file_to_open, "build/structures");
+        if((asset_file = fopen(asset_file_to_open, "wb")) == NULL) exit_with_error("Could not open data file for writing preprocessing result", asset_file_to_open);
+        fwrite(structure_offsets, sizeof(unsigned long), NUM_STRUCTURES, asset_file);
+        fwrite(structure_data, 1, structure_data_length, asset_file);
+        fclose(asset_file);
+        free(structure_data);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,31 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+// Random numbers for world generation are not drawn from a shared generator, since the result would then depend on the order chunks are generated in,
+// and every thread would have to take turns using it. Instead each number is a hash of everything which identifies it - the world seed, the chunk,
+// which feature of the chunk it is for, and a counter for when a feature needs more than one number. The same inputs always give the same number
+typedef enum { FEATURE_STRUCTURE_POSITION, FEATURE_STRUCTURE_VARIANT, FEATURE_STRUCTURE_SHAPE } WORLD_FEATURE;
+
+unsigned long long world_seed = 0;
+
+// The SplitMix64 finaliser, which spreads every bit of the input across the whole output
+unsigned long long mix_random_bits(unsigned long long value)
+{
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+    return value ^ (value >> 31);
+}
+
+unsigned long long random_bits(int chunk_x, int chunk_z, WORLD_FEATURE feature, unsigned int counter)
+{
+    unsigned long long value = mix_random_bits(world_seed + 0x9E3779B97F4A7C15ULL);
+    value = mix_random_bits(value ^ (unsigned int)chunk_x);
+    value = mix_random_bits(value ^ (unsigned int)chunk_z);
+    value = mix_random_bits(value ^ ((unsigned long long)feature << 32 | counter));
+    return value;
+}
+
+// Returns a random number from 0 up to (but not including) 1
+float random_float(int chunk_x, int chunk_z, WORLD_FEATURE feature, unsigned int counter) { return (random_bits(chunk_x, chunk_z, feature, counter) >> 40) / (float)(1 << 24); }
+
+#endif
\ No newline at end of file
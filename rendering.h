@@ -3,10 +3,14 @@
 #include"shaders.h"
 #include<glad/glad.h>
 
+// The vertices of chunks and LOD chunks are packed into two 32 bit words (the VERTEX_PACKED property), since every part of them is a small whole number.
+// The first has the position in the chunk - x in bits 0-5, y in 6-14 and -z in 15-20 - then the texture coordinate across the face in 21-26 and the face
+// the vertex belongs to in 27-29. The second has the texture coordinate up the face in 0-8 (LOD walls can be taller than a section), and where the face's
+// texture indices start in the index texture, x in 9-19 and y in 20-30 - or with face layers (BLOCK_TEXTURING, in world.h), the face's layer in the block
+// texture array in 9-19
 typedef struct BLOCK_VERTEX
 {
-    vec3 position;
-    vec2 uv, uv2;
+    unsigned int packed[2];
 } BLOCK_VERTEX;
 
 typedef struct SKY_VERTEX
@@ -21,6 +25,9 @@ typedef struct MODEL
     VERTEX_PROPERTY vertex_properties;
     unsigned int vertex_array_object, vertex_buffer, index_buffer, *indices;
     unsigned long num_vertices, num_indices, vertex_capacity, index_capacity;
+    unsigned long num_uploaded_indices; // The number of indices in the index buffer, which is what gets drawn - so the model can be rebuilt while it is still being rendered
+    bool quads; // Set for models made only of quads, which are drawn with the shared quad index buffer instead of indices of their own
+    bool pulled; // Set for quad models drawn by vertex pulling, which hold one packed face per quad instead of four vertices (see QUAD_RENDERING below)
     bool deallocate;
 } MODEL;
 
@@ -33,7 +40,28 @@ extern char _binary_build_predefined_models_start[];
 extern char _binary_build_predefined_models_end[];
 extern char _binary_build_predefined_models_length[];
 
+#define QUAD_INDEX_INITIAL_QUADS 65536 // The number of quads the shared quad index buffer starts out with indices for. It grows if a model needs more
+
+// How quad models are drawn, which is chosen at startup (before any are made). With vertices, each quad is four vertices joined up by the shared quad index buffer.
+// With pulling, each quad is a single packed face in a shader storage buffer, which has the same layout as a vertex but with the corner of the face nearest the origin
+// as its position and the width and height of the face as its texture coordinates - the vertex shader (block-pulled-vertex) rebuilds the six corners of its two
+// triangles from gl_VertexID, so the model has no vertex attributes or indices at all
+typedef enum { QUAD_RENDERING_VERTICES, QUAD_RENDERING_PULLED, NUM_QUAD_RENDERING_MODES } QUAD_RENDERING;
+const char* quad_rendering_names[] = { "vertices", "pulled" };
+
 #ifndef ONLY_INCLUDE_DEFINITIONS
+// Every quad model shares one index buffer, which joins up each four vertices in a row into a quad as (0, 1, 2), (2, 1, 3), so they only store and upload vertices
+unsigned int quad_index_buffer = 0;
+unsigned long quad_index_capacity = 0; // The number of quads the shared quad index buffer has indices for
+QUAD_RENDERING quad_rendering = QUAD_RENDERING_VERTICES;
+
+// Packs the parts of a chunk vertex together, as laid out above
+BLOCK_VERTEX pack_block_vertex(vec3 position, vec2 uv, vec2 index_offset, unsigned char face_index)
+{
+    unsigned int x = position.x, y = position.y, z = -position.z, u = uv.x, v = uv.y, index_x = index_offset.x, index_y = index_offset.y;
+    return (BLOCK_VERTEX){ { x | (y << 6) | (z << 15) | (u << 21) | ((unsigned int)face_index << 27), v | (index_x << 9) | (index_y << 20) } };
+}
+
 // Allocates memory for a new model with the specified vertex properties
 // Optionally specify the number of vertices and indices to initially allocate memory for (default 256).
 // Optionally pass a pointer to an existing vertex and index array, in this case the model will wrap these pointers instead of allocating memory. Make sure you still pass the number of vertices and indices, the model needs it to render properly
@@ -60,20 +88,86 @@ MODEL* make_model(VERTEX_PROPERTY vertex_properties, size_t num_vertices, size_t
     return to_return;
 }
 
+// Allocates memory for a new model made only of quads, which has room for num_vertices vertices to start with (at least 256).
+// Every four vertices added make a quad, and num_indices should go up by six for each - the model has no indices of its own, but that's still how many are drawn.
+// When quads are pulled, each quad is one packed face rather than four vertices, so num_vertices goes up by one for each instead
+MODEL* make_quad_model(VERTEX_PROPERTY vertex_properties, size_t num_vertices)
+{
+    MODEL* to_return = calloc(1, sizeof(MODEL));
+    to_return->vertex_properties = vertex_properties;
+    to_return->quads = true;
+    to_return->pulled = quad_rendering == QUAD_RENDERING_PULLED;
+    to_return->vertex_capacity = num_vertices > 256 ? num_vertices : 256;
+    to_return->vertices = calloc(to_return->vertex_capacity, vertex_size(vertex_properties));
+    to_return->deallocate = true;
+    return to_return;
+}
+
+// Binds the shared quad index buffer to the vertex array object which is bound, after making sure it has indices for at least num_quads quads.
+// When it grows, the vertex array objects it is already bound to see the new indices too, since they refer to the same buffer
+void bind_quad_indices(unsigned long num_quads)
+{
+    if(!quad_index_buffer) glGenBuffers(1, &quad_index_buffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quad_index_buffer);
+    if(quad_index_capacity && num_quads <= quad_index_capacity) return;
+
+    const unsigned int quad_pattern[] = { 0, 1, 2, 2, 1, 3 };
+    unsigned long capacity = quad_index_capacity ? quad_index_capacity : QUAD_INDEX_INITIAL_QUADS;
+    while(capacity < num_quads) capacity *= 2;
+    unsigned int* indices = malloc(capacity * 6 * sizeof(unsigned int));
+    if(!indices) exit_with_error("Memory allocation error", "malloc() failed while allocating the shared quad indices");
+    for(unsigned long quad = 0; quad < capacity; quad++)
+        for(unsigned int i = 0; i < 6; i++) indices[(quad * 6) + i] = (quad * 4) + quad_pattern[i];
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, capacity * 6 * sizeof(unsigned int), indices, GL_STATIC_DRAW);
+    free(indices);
+    quad_index_capacity = capacity;
+}
+
 // Takes the vertex and index data stored inside the model, and generates opengl objects from them
 void finalise_model(MODEL* to_finalise)
 {
     glGenVertexArrays(1, &(to_finalise->vertex_array_object));
     glBindVertexArray(to_finalise->vertex_array_object);
     glGenBuffers(1, &(to_finalise->vertex_buffer));
-    glGenBuffers(1, &(to_finalise->index_buffer));
+    if(to_finalise->pulled)
+    {
+        // The faces go in a shader storage buffer, and the vertex array object stays empty - it only has to be bound for drawing
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, to_finalise->vertex_buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, vertex_size(to_finalise->vertex_properties) * to_finalise->num_vertices, to_finalise->vertices, GL_STATIC_DRAW);
+        to_finalise->num_uploaded_indices = to_finalise->num_indices;
+        return;
+    }
     glBindBuffer(GL_ARRAY_BUFFER, to_finalise->vertex_buffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, to_finalise->index_buffer);
     glBufferData(GL_ARRAY_BUFFER, vertex_size(to_finalise->vertex_properties) * to_finalise->num_vertices, to_finalise->vertices, GL_STATIC_DRAW);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * to_finalise->num_indices, to_finalise->indices, GL_STATIC_DRAW);
+    if(to_finalise->quads) bind_quad_indices(to_finalise->num_vertices / 4);
+    else
+    {
+        glGenBuffers(1, &(to_finalise->index_buffer));
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, to_finalise->index_buffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * to_finalise->num_indices, to_finalise->indices, GL_STATIC_DRAW);
+    }
+    to_finalise->num_uploaded_indices = to_finalise->num_indices;
     configure_vertex_properties(to_finalise->vertex_properties);
 }
 
+// Uploads the vertex and index data stored inside an already finalised model again, after it has been changed
+void update_model(MODEL* to_update)
+{
+    if(to_update->pulled)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, to_update->vertex_buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, vertex_size(to_update->vertex_properties) * to_update->num_vertices, to_update->vertices, GL_STATIC_DRAW);
+        to_update->num_uploaded_indices = to_update->num_indices;
+        return;
+    }
+    glBindVertexArray(to_update->vertex_array_object);
+    glBindBuffer(GL_ARRAY_BUFFER, to_update->vertex_buffer);
+    glBufferData(GL_ARRAY_BUFFER, vertex_size(to_update->vertex_properties) * to_update->num_vertices, to_update->vertices, GL_STATIC_DRAW);
+    if(to_update->quads) bind_quad_indices(to_update->num_vertices / 4);
+    else glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * to_update->num_indices, to_update->indices, GL_STATIC_DRAW);
+    to_update->num_uploaded_indices = to_update->num_indices;
+}
+
 // Creates a new model loaded with data from one of the predefined models built into the application (such as the sky)
 MODEL* load_predefined_model(MODEL_TYPE to_load)
 {
@@ -90,18 +184,37 @@ MODEL* load_predefined_model(MODEL_TYPE to_load)
 void render_model(MODEL* to_render)
 {
     glBindVertexArray(to_render->vertex_array_object);
-    glDrawElements(GL_TRIANGLES, to_render->num_indices, GL_UNSIGNED_INT, 0);
+    if(to_render->pulled)
+    {
+        // The faces are read from binding point 0 (chunk_faces in block-pulled-vertex), and models without any faces have nothing to draw
+        if(!to_render->num_uploaded_indices) return;
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, to_render->vertex_buffer);
+        glDrawArrays(GL_TRIANGLES, 0, to_render->num_uploaded_indices);
+        return;
+    }
+    glDrawElements(GL_TRIANGLES, to_render->num_uploaded_indices, GL_UNSIGNED_INT, 0);
 }
 
 void unload_model(MODEL* to_unload)
 {
-    glDeleteBuffers(1, &(to_unload->vertex_buffer));
-    glDeleteBuffers(1, &(to_unload->index_buffer));
+    // Models which were never finalised (such as chunks generated without a window) don't have any opengl objects to delete
+    if(to_unload->vertex_array_object)
+    {
+        glDeleteBuffers(1, &(to_unload->vertex_buffer));
+        glDeleteBuffers(1, &(to_unload->index_buffer));
+    }
     if(to_unload->deallocate)
     {
         free(to_unload->vertices);
         free(to_unload->indices);
     }
 }
+
+void unload_quad_indices()
+{
+    if(quad_index_buffer) glDeleteBuffers(1, &quad_index_buffer);
+    quad_index_buffer = 0;
+    quad_index_capacity = 0;
+}
 #endif
 #endif
\ No newline at end of file
@@ -0,0 +1,208 @@
+#ifndef SAVE_H
+#define SAVE_H
+#include<stdio.h>
+#include<string.h>
+#ifdef _WIN32
+#include<direct.h>
+#define make_directory(path) _mkdir(path)
+#else
+#include<sys/stat.h>
+#define make_directory(path) mkdir(path, 0755)
+#endif
+
+#include"util.h"
+#include"world.h"
+#include"pending_writes.h"
+
+// Worlds are saved into a directory per seed, with one file per chunk, so that any chunk can be loaded on its own. Each chunk file is a header followed
+// by its sections from the bottom up - sections which are all one block are saved as just that block, and the rest as runs of the same block in cube array order.
+// Blocks which structures spilled into chunks that haven't been saved yet are kept in a separate file, so they aren't lost when those chunks are generated
+#define SAVE_DIRECTORY "saves"
+#define SAVE_CHUNK_MAGIC 0x4B434643 // "CFCK" when read as bytes
+#define SAVE_PENDING_MAGIC 0x57504643 // "CFPW"
+#define SAVE_FORMAT_VERSION 1
+#define SAVE_UNIFORM_SECTION 0
+#define SAVE_RUNS_SECTION 1
+
+typedef struct SAVE_CHUNK_HEADER
+{
+    unsigned int magic, version;
+    int chunk_x, chunk_z;
+    unsigned char generated_sections;
+} SAVE_CHUNK_HEADER;
+
+typedef struct SAVE_RUN
+{
+    unsigned short length;
+    unsigned char type;
+} SAVE_RUN;
+
+char world_save_directory[256] = { 0 };
+
+// Picks the directory the world with this seed is saved in, creating it if needed
+void open_world_save(unsigned long long seed)
+{
+    make_directory(SAVE_DIRECTORY);
+    snprintf(world_save_directory, sizeof(world_save_directory), SAVE_DIRECTORY "/%llu", seed);
+    make_directory(world_save_directory);
+}
+
+void chunk_save_path(char* path, size_t path_size, int chunk_x, int chunk_z) { snprintf(path, path_size, "%s/%d.%d.chunk", world_save_directory, chunk_x, chunk_z); }
+
+bool save_chunk(CHUNK* chunk)
+{
+    char path[512];
+    SAVE_CHUNK_HEADER header = { .magic = SAVE_CHUNK_MAGIC, .version = SAVE_FORMAT_VERSION, .chunk_x = chunk_coordinate(chunk->position.x),
+                                 .chunk_z = chunk_coordinate(chunk->position.z), .generated_sections = chunk->generated_sections };
+    chunk_save_path(path, sizeof(path), header.chunk_x, header.chunk_z);
+    FILE* save_file = fopen(path, "wb");
+    if(!save_file) return false;
+
+    fwrite(&header, sizeof(header), 1, save_file);
+    for(unsigned int section = 0; section < CHUNK_SECTIONS; section++)
+    {
+        const CUBE* cubes = chunk->sections[section];
+        if(!cubes)
+        {
+            fputc(SAVE_UNIFORM_SECTION, save_file);
+            fputc(chunk->uniform_cubes[section].type, save_file);
+            continue;
+        }
+
+        // The runs are counted first, then written out one at a time, so that they never need to be held all at once
+        unsigned int num_runs = 1;
+        for(unsigned int i = 1; i < CHUNK_SECTION_BLOCKS; i++) num_runs += cubes[i].type != cubes[i - 1].type;
+        fputc(SAVE_RUNS_SECTION, save_file);
+        fwrite(&num_runs, sizeof(num_runs), 1, save_file);
+        SAVE_RUN run = { .length = 1, .type = cubes[0].type };
+        for(unsigned int i = 1; i <= CHUNK_SECTION_BLOCKS; i++)
+        {
+            if(i < CHUNK_SECTION_BLOCKS && cubes[i].type == run.type) run.length++;
+            else
+            {
+                fwrite(&run, sizeof(SAVE_RUN), 1, save_file);
+                if(i < CHUNK_SECTION_BLOCKS) run = (SAVE_RUN){ .length = 1, .type = cubes[i].type };
+            }
+        }
+    }
+    return !fclose(save_file);
+}
+
+// Loads the blocks of the saved chunk at a position into an already allocated chunk, in place of its terrain and structures.
+// Returns false if the chunk hasn't been saved (or the file can't be read, or is damaged), in which case the chunk needs to be generated instead.
+// The runs are read one at a time, since this runs on the workers, which don't have much stack to spare
+bool load_chunk_blocks(vec3 position, CHUNK* place_into)
+{
+    char path[512];
+    SAVE_RUN run;
+    SAVE_CHUNK_HEADER header;
+    chunk_save_path(path, sizeof(path), chunk_coordinate(position.x), chunk_coordinate(position.z));
+    FILE* save_file = fopen(path, "rb");
+    if(!save_file) return false;
+    if(fread(&header, sizeof(header), 1, save_file) != 1 || header.magic != SAVE_CHUNK_MAGIC || header.version != SAVE_FORMAT_VERSION)
+    {
+        fclose(save_file);
+        return false;
+    }
+
+    // Block types past the end of the block list would index off the end of the meshers' tables, so a file with any of them (or with sections cut short,
+    // or runs which don't cover their section exactly) is treated as damaged
+    prepare_chunk(place_into, position);
+    for(unsigned int section = 0; section < CHUNK_SECTIONS; section++)
+    {
+        int section_kind = fgetc(save_file);
+        if(section_kind == SAVE_UNIFORM_SECTION)
+        {
+            // Uniform sections don't need their trees built block by block - they are either completely full or completely empty
+            int type = fgetc(save_file);
+            if(type == EOF || type > NUM_BLOCK_TYPES)
+            {
+                fclose(save_file);
+                return false;
+            }
+            place_into->uniform_cubes[section].type = type;
+            if(type != EMPTY) (transparent_block(type) ? place_into->transparency_fill_state : place_into->cube_fill_state)[section].full = CHUNK_FULL;
+            continue;
+        }
+
+        unsigned int num_runs = 0, block = 0;
+        bool damaged = section_kind != SAVE_RUNS_SECTION || fread(&num_runs, sizeof(num_runs), 1, save_file) != 1 || num_runs > CHUNK_SECTION_BLOCKS;
+        CUBE* cubes = damaged ? NULL : chunk_section(place_into, section);
+        for(unsigned int i = 0; !damaged && i < num_runs; i++)
+        {
+            damaged = fread(&run, sizeof(SAVE_RUN), 1, save_file) != 1 || run.type > NUM_BLOCK_TYPES || run.length > CHUNK_SECTION_BLOCKS - block;
+            for(unsigned int j = 0; !damaged && j < run.length; j++) cubes[block++].type = run.type;
+        }
+        if(damaged || block != CHUNK_SECTION_BLOCKS)
+        {
+            fclose(save_file);
+            return false;
+        }
+        cube_tree_fill_blocks(place_into, place_into->cube_fill_state + section, false);
+        cube_tree_fill_blocks(place_into, place_into->transparency_fill_state + section, true);
+    }
+    fclose(save_file);
+
+    place_into->generated_sections = header.generated_sections;
+    return true;
+}
+
+// Loads the saved chunk at a position into an already allocated chunk, then adds any blocks spilled into it and builds its models, like make_chunk.
+// Returns false if the chunk hasn't been saved, like load_chunk_blocks
+bool load_chunk(vec3 position, CHUNK* place_into)
+{
+    if(!load_chunk_blocks(position, place_into)) return false;
+    complete_chunk(place_into);
+    return true;
+}
+
+// Saves the pending writes for every chunk outside of the area from (min_x, min_z) to (max_x, max_z) in chunk coordinates - the chunks inside it are expected
+// to have been saved with their pending writes already applied. Only call this once no other threads are adding pending writes
+bool save_pending_writes(int min_x, int min_z, int max_x, int max_z)
+{
+    char path[512];
+    unsigned int magic = SAVE_PENDING_MAGIC, version = SAVE_FORMAT_VERSION;
+    snprintf(path, sizeof(path), "%s/pending", world_save_directory);
+    FILE* save_file = fopen(path, "wb");
+    if(!save_file) return false;
+
+    fwrite(&magic, sizeof(magic), 1, save_file);
+    fwrite(&version, sizeof(version), 1, save_file);
+    for(unsigned int i = 0; i < PENDING_WRITES_BUCKETS; i++)
+    {
+        for(PENDING_CHUNK* pending = pending_chunks[i]; pending; pending = pending->next)
+        {
+            if(pending->chunk_x >= min_x && pending->chunk_x <= max_x && pending->chunk_z >= min_z && pending->chunk_z <= max_z) continue;
+            for(PENDING_WRITE* write = pending->writes; write; write = write->next)
+            {
+                fwrite(&(pending->chunk_x), sizeof(int), 1, save_file);
+                fwrite(&(pending->chunk_z), sizeof(int), 1, save_file);
+                fwrite(&(write->num_blocks), sizeof(unsigned int), 1, save_file);
+                fwrite(write->blocks, sizeof(PENDING_BLOCK), write->num_blocks, save_file);
+            }
+        }
+    }
+    return !fclose(save_file);
+}
+
+// Adds the pending writes saved alongside the world back into the pending writes, so they are placed when their chunks are generated
+void load_pending_writes()
+{
+    char path[512];
+    PENDING_BLOCK blocks[STRUCTURE_MAX_SIZE * STRUCTURE_MAX_SIZE * STRUCTURE_MAX_SIZE];
+    unsigned int magic, version, num_blocks;
+    int chunk_x, chunk_z;
+    snprintf(path, sizeof(path), "%s/pending", world_save_directory);
+    FILE* save_file = fopen(path, "rb");
+    if(!save_file) return;
+
+    if(fread(&magic, sizeof(magic), 1, save_file) == 1 && fread(&version, sizeof(version), 1, save_file) == 1 && magic == SAVE_PENDING_MAGIC && version == SAVE_FORMAT_VERSION)
+    {
+        while(fread(&chunk_x, sizeof(int), 1, save_file) == 1 && fread(&chunk_z, sizeof(int), 1, save_file) == 1 && fread(&num_blocks, sizeof(unsigned int), 1, save_file) == 1 &&
+              num_blocks <= STRUCTURE_MAX_SIZE * STRUCTURE_MAX_SIZE * STRUCTURE_MAX_SIZE && fread(blocks, sizeof(PENDING_BLOCK), num_blocks, save_file) == num_blocks)
+            add_pending_write(chunk_x, chunk_z, blocks, num_blocks);
+    }
+    fclose(save_file);
+}
+
+#endif
\ No newline at end of file
@@ -11,10 +11,11 @@ void stbi_image_free(void*);
 // 1 - Model Matrix (tranformation - local -> world space)
 // 2 - View Matrix (world -> camera space)
 // 3 - Projection Matrix (camera -> clip space)
-#define NUM_SHADERS 5
-typedef enum            { BLOCK_VERTEX_SHADER, BLOCK_FRAGMENT_SHADER, DEBUG_FRAGMENT_SHADER, SKY_VERTEX_SHADER, SKY_FRAGMENT_SHADER } SHADER;
-char* shader_names[] =  {"block-vertex",      "block-fragment",      "debug-fragment",      "sky-vertex",      "sky-fragment" };
-typedef enum { MODEL_MATRIX = 3, VIEW_MATRIX = 4, PROJECTION_MATRIX = 5 } SHADER_VALUE;
+// 4 - Index Region Origin (where the chunk's texture indices are in the index atlas, and its layer)
+#define NUM_SHADERS 7
+typedef enum            { BLOCK_VERTEX_SHADER, BLOCK_PULLED_VERTEX_SHADER, BLOCK_FRAGMENT_SHADER, BLOCK_LAYER_FRAGMENT_SHADER, DEBUG_FRAGMENT_SHADER, SKY_VERTEX_SHADER, SKY_FRAGMENT_SHADER } SHADER;
+char* shader_names[] =  {"block-vertex",      "block-pulled-vertex",      "block-fragment",      "block-layer-fragment",      "debug-fragment",      "sky-vertex",      "sky-fragment" };
+typedef enum { MODEL_MATRIX = 3, VIEW_MATRIX = 4, PROJECTION_MATRIX = 5, INDEX_REGION_ORIGIN = 6 } SHADER_VALUE;
 unsigned int shaders[NUM_SHADERS] = { 0 };
 unsigned int current_shader_program = 0;
 
@@ -22,14 +23,16 @@ extern char _binary_build_shaders_txt_start[];
 extern char _binary_build_shaders_txt_end[];
 extern char _binary_build_shaders_txt_length[];
 
-#define NUM_VERTEX_PROPERTIES 5
-unsigned int vertex_attrib_sizes[] = { 3, 2, 2, 3, 3 };
-typedef enum { VERTEX_POSITION = 0b10000000, VERTEX_UV = 0b01000000, VERTEX_UV2 = 0b00100000, VERTEX_COLOUR = 0b00010000, VERTEX_NORMAL = 0b00001000 } VERTEX_PROPERTY;
+#define NUM_VERTEX_PROPERTIES 6
+unsigned int vertex_attrib_sizes[] = { 3, 2, 2, 3, 3, 2 };
+bool vertex_attrib_integers[] = { false, false, false, false, false, true }; // Integer attributes are unsigned ints which reach the shader as they are, rather than floats
+typedef enum { VERTEX_POSITION = 0b10000000, VERTEX_UV = 0b01000000, VERTEX_UV2 = 0b00100000, VERTEX_COLOUR = 0b00010000, VERTEX_NORMAL = 0b00001000, VERTEX_PACKED = 0b00000100 } VERTEX_PROPERTY;
 
 #ifndef ONLY_INCLUDE_DEFINITIONS
 // Update methods for each data type used in the shaders. Shader_update_methods is an array containing the method to use for each value.
 void update_shader_matrix(unsigned int shader_program, SHADER_VALUE value, void* to_set) { glUniformMatrix4fv(value, 1, GL_FALSE, (const GLfloat*)((mat4*)to_set)->values); };
-void (*shader_update_methods[])(unsigned int, SHADER_VALUE, void*) = { NULL, NULL, NULL, update_shader_matrix, update_shader_matrix, update_shader_matrix };
+void update_shader_ivec3(unsigned int shader_program, SHADER_VALUE value, void* to_set) { glUniform3iv(value, 1, (const GLint*)to_set); };
+void (*shader_update_methods[])(unsigned int, SHADER_VALUE, void*) = { NULL, NULL, NULL, update_shader_matrix, update_shader_matrix, update_shader_matrix, update_shader_ivec3 };
 void set_shader_value(SHADER_VALUE value, void* to_set) { shader_update_methods[value](current_shader_program, value, to_set); }
 
 unsigned int load_shader(unsigned long type_of_shader, SHADER shader_to_load) // Internal
@@ -101,20 +104,21 @@ size_t vertex_size(VERTEX_PROPERTY properties_used)
     for(unsigned char i = 0; i < NUM_VERTEX_PROPERTIES; i++)
     {
         if(properties_used & (1 << (7 - i)))
-            to_return += vertex_attrib_sizes[i] * sizeof(GLfloat);
+            to_return += vertex_attrib_sizes[i] * (vertex_attrib_integers[i] ? sizeof(GLuint) : sizeof(GLfloat));
     }
     return to_return;
 }
 
 void configure_vertex_properties(VERTEX_PROPERTY properties_to_use)
 {
+    // Each property in use starts where the one before it in use ends
     unsigned long long stride = 0, offsets[8] = { 0 };
     for(unsigned char i = 0; i < NUM_VERTEX_PROPERTIES; i++)
     {
         if(properties_to_use & (1 << (7 - i)))
         {
-            stride += vertex_attrib_sizes[i] * sizeof(GLfloat);
-            if(i > 0) offsets[i] = offsets[i - 1] + (vertex_attrib_sizes[i - 1] * sizeof(GLfloat));
+            offsets[i] = stride;
+            stride += vertex_attrib_sizes[i] * (vertex_attrib_integers[i] ? sizeof(GLuint) : sizeof(GLfloat));
         }
     }
 
@@ -123,7 +127,8 @@ void configure_vertex_properties(VERTEX_PROPERTY properties_to_use)
         if(properties_to_use & (1 << (7 - i)))
         {
             // Args: Attribute to configure, num elems, type, whether to normalize, stride (between attrib in next vertex), offset(where it begins)
-            glVertexAttribPointer(i, vertex_attrib_sizes[i], GL_FLOAT, GL_FALSE, stride, (void*)(offsets[i]));
+            if(vertex_attrib_integers[i]) glVertexAttribIPointer(i, vertex_attrib_sizes[i], GL_UNSIGNED_INT, stride, (void*)(offsets[i]));
+            else glVertexAttribPointer(i, vertex_attrib_sizes[i], GL_FLOAT, GL_FALSE, stride, (void*)(offsets[i]));
             glEnableVertexAttribArray(i);
         }
     }
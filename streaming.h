@@ -0,0 +1,719 @@
+#ifndef STREAMING_H
+#define STREAMING_H
+#include<stdio.h>
+#include<stdlib.h>
+#include<math.h>
+#include<SDL2/SDL.h>
+
+#include"os.h"
+#include"util.h"
+#include"math3d.h"
+#include"camera.h"
+#include"world.h"
+#include"save.h"
+#include"lod.h"
+
+// Keeps the chunks around the camera generated as it moves, by reusing the chunks in the chunk buffer. Each frame, the chunks within the stream
+// radius of the camera which haven't been generated yet are requested - the ones in the camera's view first, since a missing chunk there is
+// a visible hole in the world. The camera's position is also extrapolated from the last few frames, and once those are done, the chunks around
+// where it is about to be are generated ahead of time (prefetched), so that they are usually ready by the time the camera gets there.
+// Unfinished chunks which end up out of range of both are cancelled, so that they stop taking time away from the ones which are still needed
+#define STREAM_HISTORY_SIZE 16 // The number of recent camera positions the camera's velocity is worked out from
+#define STREAM_PREFETCH_TIME 1.0f // How far ahead, in seconds, the camera's position is predicted to decide which chunks to prefetch
+#define STREAM_LATENCY_BUCKETS 16 // Latencies are counted in buckets of powers of two, from under 0.125ms up to over 2 seconds
+#define STREAM_UPLOAD_TIME_BUDGET 4.0 // The most time, in milliseconds, uploading chunks is allowed to take each frame
+#define STREAM_UPLOAD_BYTE_BUDGET (32 * 1024 * 1024) // The most bytes of chunk data which are uploaded each frame
+#define STREAM_JOBS_AHEAD 4 // The most jobs spawned for each worker which haven't started yet - about a frame's work, so that the workers don't run out before the next one
+
+// Each chunk goes through the stages in order, and each stage has its own queue (the chunks waiting on it) and a budget of how many chunks can be
+// working through it at once. A chunk moves on to the next stage as soon as the inputs it needs are ready - for most stages that's just the stage before,
+// but blocks spilled from the neighbours' structures are only added once the neighbours have placed their structures, and the model is only built once
+// the neighbours have all their blocks, so that faces against them can be hidden - either way, so that the model isn't built just to be built again straight after.
+// Finished chunks are built again in the background whenever they change, or a neighbour turns up (or generates more of itself) after they were built,
+// and are uploaded again within the same budget. They are still rendered with their old models until then.
+// The stages run in the background on the thread pool, and the render loop never waits for them - each frame it takes the chunks whose stage has
+// finished since the last one, works out every chunk's priority again from where the camera is now, and starts the stages of the chunks which are
+// ready in order of priority (across all the stages, so that a chunk in view close by isn't held up behind far away ones which are further along).
+// Uploading happens on the thread which owns the opengl context
+typedef enum { CHUNK_STAGE_TERRAIN, CHUNK_STAGE_STRUCTURES, CHUNK_STAGE_NEIGHBOURS, CHUNK_STAGE_MESH, CHUNK_STAGE_UPLOAD, CHUNK_STAGE_DONE, NUM_CHUNK_STAGES = CHUNK_STAGE_DONE } CHUNK_STAGE;
+const char* chunk_stage_names[] = { "terrain", "structures", "neighbours", "mesh", "upload" };
+const unsigned int default_stage_budgets[] = { 8, 8, 16, 8, 8 }; // The most chunks each stage works on at once - for uploading, the most it takes in a frame
+
+typedef enum { STREAM_PRIORITY_VISIBLE, STREAM_PRIORITY_NEARBY, STREAM_PRIORITY_PREFETCH } STREAM_PRIORITY;
+
+typedef struct STREAM_SLOT
+{
+    struct CHUNK_STREAMER* streamer;
+    CHUNK* chunk;
+    int chunk_x, chunk_z;
+    bool in_use;
+    bool prefetched; // Set for a chunk which was prefetched, until the camera comes within range of it
+    bool loaded_from_save; // Saved chunks already have their structures, so they skip that stage
+    bool working; // Set while the chunk's stage is running on the thread pool - until it's finished, nothing else touches the chunk and the slot can't be reused
+    bool rebuilt; // Set for a finished chunk whose models have been built again, until they are uploaded
+    unsigned char required_sections; // The sections a finished chunk generates before it is built again, one bit for each
+    SDL_atomic_t cancelled; // Set when the chunk isn't needed any more while it's working. Its stage is skipped if it hasn't started yet, and the slot is freed once it's finished
+    STREAM_PRIORITY priority;
+    float distance; // From the camera, in chunks
+    CHUNK_STAGE stage; // The stage the chunk is queued for, or working through
+    Uint64 stage_queued_time; // When the chunk joined the queue of its current stage
+    struct STREAM_SLOT* next_finished;
+} STREAM_SLOT;
+
+typedef struct STREAM_REQUEST
+{
+    int chunk_x, chunk_z;
+    STREAM_PRIORITY priority;
+    float distance; // From the camera (or for prefetched chunks, from where the camera is predicted to be), in chunks
+} STREAM_REQUEST;
+
+typedef struct STREAM_JOB
+{
+    STREAM_SLOT* slot;
+    CHUNK_STAGE stage;
+    STREAM_PRIORITY priority;
+    float distance;
+} STREAM_JOB;
+
+typedef struct STREAM_STATS
+{
+    unsigned long frames, frames_missing_visible; // frames_missing_visible counts frames where a chunk in front of the camera wasn't finished yet
+    unsigned long chunks_generated, chunks_prefetched, chunks_cancelled, chunks_rebuilt;
+    unsigned long prefetch_hits, prefetch_misses; // Prefetched chunks the camera reached, and ones which were reused for something else before it did
+    unsigned long upload_frames, upload_hitches; // Frames where any chunks were uploaded, and ones where uploading went over the time budget
+    unsigned long upload_backlog, max_upload_backlog; // The total and the most chunks left waiting to be uploaded at the end of a frame
+    unsigned long long bytes_uploaded;
+    double upload_time, max_upload_time; // In seconds
+    unsigned long stage_latencies[NUM_CHUNK_STAGES][STREAM_LATENCY_BUCKETS]; // How long chunks took from joining each stage's queue to finishing the stage
+} STREAM_STATS;
+
+typedef struct CHUNK_STREAMER
+{
+    int radius;
+    unsigned int num_slots, stage_budgets[NUM_CHUNK_STAGES];
+    double upload_time_budget; // In milliseconds
+    size_t upload_byte_budget;
+    STREAM_SLOT* slots;
+    STREAM_REQUEST* requests;
+    STREAM_JOB* jobs; // A binary heap of the chunks ready for their next stage, with the most important at the top
+    void* finished_slots; // The slots whose stage has finished, which the workers push onto and the render loop takes all at once (a lock-free stack)
+    WAIT_GROUP working; // Counts the stages running on the thread pool
+    SDL_atomic_t jobs_waiting; // The stages which have been spawned, but which no worker has started yet
+    vec3 camera_history[STREAM_HISTORY_SIZE], velocity;
+    double history_times[STREAM_HISTORY_SIZE], time;
+    unsigned int history_length, history_next;
+    int centre_x, centre_z, predicted_x, predicted_z;
+    int camera_section; // The section of the chunks the camera is in
+    STREAM_STATS stats;
+} CHUNK_STREAMER;
+
+// The chunk coordinates of the chunk containing a point. Chunks reach from their position along the negative z axis, so the z coordinate rounds up
+int stream_chunk_x(float x) { return (int)floorf(x / CHUNK_SIZE); }
+int stream_chunk_z(float z) { return (int)ceilf(z / CHUNK_SIZE); }
+
+bool stream_in_range(CHUNK_STREAMER* streamer, int centre_x, int centre_z, int chunk_x, int chunk_z) { return abs(chunk_x - centre_x) <= streamer->radius && abs(chunk_z - centre_z) <= streamer->radius; }
+
+// Sets up a streamer for the chunks up to radius chunks away from the camera (in a square), where each stage but uploading works on at most
+// chunks_per_stage chunks at once. The chunk buffer is allocated with room for every chunk in range, plus a row more which prefetched chunks can be kept in
+CHUNK_STREAMER* make_chunk_streamer(int radius, unsigned int chunks_per_stage)
+{
+    CHUNK_STREAMER* to_return = calloc(1, sizeof(CHUNK_STREAMER));
+    unsigned int side = radius * 2 + 1;
+    to_return->radius = radius;
+    to_return->num_slots = side * side + side + 1;
+    for(unsigned int i = 0; i < NUM_CHUNK_STAGES; i++) to_return->stage_budgets[i] = default_stage_budgets[i];
+    to_return->upload_time_budget = STREAM_UPLOAD_TIME_BUDGET;
+    to_return->upload_byte_budget = STREAM_UPLOAD_BYTE_BUDGET;
+    if(chunks_per_stage) for(unsigned int i = 0; i < CHUNK_STAGE_UPLOAD; i++) to_return->stage_budgets[i] = chunks_per_stage;
+    to_return->slots = calloc(to_return->num_slots, sizeof(STREAM_SLOT));
+    to_return->requests = calloc(side * side * 2, sizeof(STREAM_REQUEST));
+    to_return->jobs = calloc(to_return->num_slots, sizeof(STREAM_JOB));
+
+    initialize_chunk_buffer(to_return->num_slots);
+    chunk_buffer_size = to_return->num_slots;
+    for(unsigned int i = 0; i < to_return->num_slots; i++)
+    {
+        to_return->slots[i].streamer = to_return;
+        to_return->slots[i].chunk = chunks[i];
+    }
+    return to_return;
+}
+
+// Returns the slot holding the chunk at these chunk coordinates, whichever stage it is at, or NULL if it isn't being generated
+STREAM_SLOT* find_stream_slot(CHUNK_STREAMER* streamer, int chunk_x, int chunk_z)
+{
+    for(unsigned int i = 0; i < streamer->num_slots; i++)
+    {
+        STREAM_SLOT* slot = streamer->slots + i;
+        if(slot->in_use && slot->chunk_x == chunk_x && slot->chunk_z == chunk_z) return slot;
+    }
+    return NULL;
+}
+
+// Returns the finished chunk at these chunk coordinates, or NULL if there isn't one
+CHUNK* streamed_chunk(CHUNK_STREAMER* streamer, int chunk_x, int chunk_z)
+{
+    STREAM_SLOT* slot = find_stream_slot(streamer, chunk_x, chunk_z);
+    return slot && slot->stage == CHUNK_STAGE_DONE ? slot->chunk : NULL;
+}
+
+// Whether any of a chunk (from the bottom of the world to the top) is inside the camera's view frustum. The chunks right around the camera always count as visible.
+// Each plane of the frustum is the sum or difference of the last column of the combined view and projection matrix and one of the others, and the chunk is
+// outside of the frustum if the corner of its box furthest along the plane's normal is still behind it
+bool stream_chunk_visible(CHUNK_STREAMER* streamer, CAMERA* camera, int chunk_x, int chunk_z)
+{
+    if(abs(chunk_x - streamer->centre_x) <= 1 && abs(chunk_z - streamer->centre_z) <= 1) return true;
+    mat4 view_projection = mat4_multiply_mat4(camera->view, camera->projection);
+    vec3 low = v3(chunk_x * CHUNK_SIZE, 0, (chunk_z - 1) * CHUNK_SIZE), high = v3((chunk_x + 1) * CHUNK_SIZE, CHUNK_MAX_HEIGHT, chunk_z * CHUNK_SIZE);
+    for(unsigned int plane = 0; plane < 6; plane++)
+    {
+        float sign = plane % 2 ? -1.0f : 1.0f, normal[4];
+        for(unsigned int i = 0; i < 4; i++) normal[i] = view_projection.values[i][3] + sign * view_projection.values[i][plane / 2];
+        float furthest = normal[3] + normal[0] * (normal[0] > 0 ? high.x : low.x) + normal[1] * (normal[1] > 0 ? high.y : low.y) + normal[2] * (normal[2] > 0 ? high.z : low.z);
+        if(furthest < 0) return false;
+    }
+    return true;
+}
+
+int compare_stream_requests(const void* first, const void* second)
+{
+    const STREAM_REQUEST* a = first, *b = second;
+    if(a->priority != b->priority) return a->priority - b->priority;
+    return (a->distance > b->distance) - (a->distance < b->distance);
+}
+
+// Whether a job should run before another - chunks in view first, then the ones in range, then prefetched ones, and the closest first within each of those
+bool stream_job_before(const STREAM_JOB* a, const STREAM_JOB* b) { return a->priority != b->priority ? a->priority < b->priority : a->distance < b->distance; }
+
+void push_stream_job(CHUNK_STREAMER* streamer, unsigned int* num_jobs, STREAM_JOB job)
+{
+    unsigned int i = (*num_jobs)++;
+    for(; i && stream_job_before(&job, streamer->jobs + ((i - 1) / 2)); i = (i - 1) / 2) streamer->jobs[i] = streamer->jobs[(i - 1) / 2];
+    streamer->jobs[i] = job;
+}
+
+STREAM_JOB pop_stream_job(CHUNK_STREAMER* streamer, unsigned int* num_jobs)
+{
+    STREAM_JOB top = streamer->jobs[0], last = streamer->jobs[--(*num_jobs)];
+    unsigned int i = 0;
+    while(i * 2 + 1 < *num_jobs)
+    {
+        unsigned int child = i * 2 + 1;
+        if(child + 1 < *num_jobs && stream_job_before(streamer->jobs + child + 1, streamer->jobs + child)) child++;
+        if(!stream_job_before(streamer->jobs + child, &last)) break;
+        streamer->jobs[i] = streamer->jobs[child];
+        i = child;
+    }
+    streamer->jobs[i] = last;
+    return top;
+}
+
+// Picks the slot to generate a chunk into - either one with nothing in it, or the one furthest from the camera which is out of range (and isn't working).
+// Prefetched chunks aren't allowed to replace chunks the camera is about to reach either. Returns NULL if there's no slot to spare
+STREAM_SLOT* stream_free_slot(CHUNK_STREAMER* streamer, STREAM_PRIORITY priority)
+{
+    STREAM_SLOT* best = NULL;
+    bool best_about_to_be_reached = true;
+    int best_distance = -1;
+    for(unsigned int i = 0; i < streamer->num_slots; i++)
+    {
+        STREAM_SLOT* slot = streamer->slots + i;
+        if(!slot->in_use) return slot;
+        if(slot->working || stream_in_range(streamer, streamer->centre_x, streamer->centre_z, slot->chunk_x, slot->chunk_z)) continue;
+        bool about_to_be_reached = stream_in_range(streamer, streamer->predicted_x, streamer->predicted_z, slot->chunk_x, slot->chunk_z);
+        if(about_to_be_reached && priority == STREAM_PRIORITY_PREFETCH) continue;
+
+        // Chunks the camera is about to reach are only replaced once nothing else can be
+        int distance = abs(slot->chunk_x - streamer->centre_x) + abs(slot->chunk_z - streamer->centre_z);
+        if(about_to_be_reached > best_about_to_be_reached || (about_to_be_reached == best_about_to_be_reached && distance <= best_distance)) continue;
+        best = slot;
+        best_about_to_be_reached = about_to_be_reached;
+        best_distance = distance;
+    }
+    return best;
+}
+
+// The neighbour on one side of a chunk (0 to 3 for front, back, left and right, as with copy_chunk_border), if it has all its blocks and
+// isn't being built again, so that its border can be copied. Returns NULL otherwise
+CHUNK* stream_border_neighbour(CHUNK_STREAMER* streamer, STREAM_SLOT* slot, unsigned char side)
+{
+    const int offset_x[] = { 0, 0, -1, 1 }, offset_z[] = { 1, -1, 0, 0 };
+    STREAM_SLOT* neighbour = find_stream_slot(streamer, slot->chunk_x + offset_x[side], slot->chunk_z + offset_z[side]);
+    if(!neighbour || neighbour->stage < CHUNK_STAGE_MESH || (neighbour->stage == CHUNK_STAGE_DONE && neighbour->working)) return NULL;
+    return neighbour->chunk;
+}
+
+// Whether a chunk's border on one side is missing or out of date, while the neighbour there can be copied from. Borders only go out of date when the
+// neighbour generates more of its sections - blocks spilled into it later only hide more faces, so the chunk just keeps a few faces it didn't need
+bool stream_border_outdated(CHUNK_STREAMER* streamer, STREAM_SLOT* slot, unsigned char side)
+{
+    CHUNK* neighbour = stream_border_neighbour(streamer, slot, side);
+    return neighbour && (!(slot->chunk->borders_known & (1 << side)) || slot->chunk->border_sections[side] != neighbour->generated_sections);
+}
+
+// Sections of the chunks deep underground are only generated once the camera gets close to them. Returns the sections within one of the camera's
+// which a chunk hasn't generated yet
+unsigned char stream_missing_sections(CHUNK_STREAMER* streamer, STREAM_SLOT* slot)
+{
+    unsigned char sections = 0;
+    for(int section = streamer->camera_section - 1; section <= streamer->camera_section + 1; section++) if(section >= 0 && section < CHUNK_SECTIONS) sections |= 1 << section;
+    return sections & ~slot->chunk->generated_sections;
+}
+
+// The stage a slot's next job is for. Finished chunks go back through meshing when they need building again, and uploading once they have been, without
+// leaving the done stage. Returns CHUNK_STAGE_DONE for a finished chunk with nothing to do
+CHUNK_STAGE stream_job_stage(CHUNK_STREAMER* streamer, STREAM_SLOT* slot)
+{
+    if(slot->stage != CHUNK_STAGE_DONE) return slot->stage;
+    if(slot->working) return CHUNK_STAGE_MESH;
+    if(slot->rebuilt) return CHUNK_STAGE_UPLOAD;
+    if(slot->chunk->model_outdated || SDL_AtomicGet(&(slot->chunk->pending->dirty)) || stream_missing_sections(streamer, slot)) return CHUNK_STAGE_MESH;
+    for(unsigned char side = 0; side < 4; side++) if(stream_border_outdated(streamer, slot, side)) return CHUNK_STAGE_MESH;
+    return CHUNK_STAGE_DONE;
+}
+
+// Whether everything a chunk needs for its queued stage is ready. Neighbours only hold a chunk up while they haven't placed their structures yet (or for
+// building the model, while they don't have all their blocks), or if they are in range of the camera and haven't been started - anything spilled by
+// neighbours generated later, and the borders of neighbours which were out of range, are picked up by building the chunk again once it is finished
+bool stream_stage_ready(CHUNK_STREAMER* streamer, STREAM_SLOT* slot)
+{
+    if(slot->stage == CHUNK_STAGE_MESH)
+    {
+        const int offset_x[] = { 0, 0, -1, 1 }, offset_z[] = { 1, -1, 0, 0 };
+        for(unsigned char side = 0; side < 4; side++)
+        {
+            int x = slot->chunk_x + offset_x[side], z = slot->chunk_z + offset_z[side];
+            if(find_stream_slot(streamer, x, z) ? !stream_border_neighbour(streamer, slot, side) : stream_in_range(streamer, streamer->centre_x, streamer->centre_z, x, z)) return false;
+        }
+        return true;
+    }
+    if(slot->stage != CHUNK_STAGE_NEIGHBOURS) return true;
+    for(int z = slot->chunk_z - 1; z <= slot->chunk_z + 1; z++)
+    {
+        for(int x = slot->chunk_x - 1; x <= slot->chunk_x + 1; x++)
+        {
+            STREAM_SLOT* neighbour = find_stream_slot(streamer, x, z);
+            if(neighbour && neighbour->stage <= CHUNK_STAGE_STRUCTURES) return false;
+            if(!neighbour && stream_in_range(streamer, streamer->centre_x, streamer->centre_z, x, z)) return false;
+        }
+    }
+    return true;
+}
+
+// Runs the stage a chunk is queued for, or builds a finished chunk again (generating the sections it was asked for first)
+void run_stream_job(STREAM_SLOT* slot)
+{
+    if(slot->stage == CHUNK_STAGE_TERRAIN)
+    {
+        vec3 position = v3(slot->chunk_x * CHUNK_SIZE, 0, slot->chunk_z * CHUNK_SIZE);
+        slot->loaded_from_save = load_chunk_blocks(position, slot->chunk);
+        if(!slot->loaded_from_save)
+        {
+            prepare_chunk(slot->chunk, position);
+            generate_chunk_terrain(slot->chunk);
+        }
+    }
+    else if(slot->stage == CHUNK_STAGE_STRUCTURES && !slot->loaded_from_save) decorate_chunk(slot->chunk);
+    else if(slot->stage == CHUNK_STAGE_NEIGHBOURS) apply_neighbour_writes(slot->chunk);
+    else if(slot->stage == CHUNK_STAGE_MESH) build_chunk_model(slot->chunk);
+    else if(slot->stage == CHUNK_STAGE_UPLOAD) upload_chunk(slot->chunk);
+    else if(slot->stage == CHUNK_STAGE_DONE)
+    {
+        for(unsigned int section = 0; section < CHUNK_SECTIONS; section++) if(slot->required_sections & (1 << section)) require_chunk_section(slot->chunk, section);
+        slot->rebuilt = rebuild_chunk(slot->chunk);
+    }
+}
+
+// Runs a chunk's stage on one of the workers, then hands the slot back to the render loop
+void run_stream_task(void* stream_slot)
+{
+    STREAM_SLOT* slot = (STREAM_SLOT*)stream_slot;
+    void** finished_slots = &(slot->streamer->finished_slots);
+    SDL_AtomicAdd(&(slot->streamer->jobs_waiting), -1);
+    if(!SDL_AtomicGet(&(slot->cancelled))) run_stream_job(slot);
+    do slot->next_finished = SDL_AtomicGetPtr(finished_slots);
+    while(!SDL_AtomicCASPtr(finished_slots, slot->next_finished, slot));
+}
+
+// Counts how long a chunk took to get through its current stage, and queues it for the next one
+void finish_stream_stage(CHUNK_STREAMER* streamer, STREAM_SLOT* slot)
+{
+    Uint64 now = SDL_GetPerformanceCounter();
+    double latency = (double)(now - slot->stage_queued_time) / SDL_GetPerformanceFrequency();
+    unsigned int bucket = 0;
+    while(bucket < STREAM_LATENCY_BUCKETS - 1 && latency >= 0.000125 * (1 << bucket)) bucket++;
+    streamer->stats.stage_latencies[slot->stage][bucket]++;
+    slot->stage++;
+    slot->stage_queued_time = now;
+}
+
+// Fills the job heap with the chunks which are ready for a stage from first_stage to last_stage, and counts the chunks already working through each stage.
+// Returns the number of jobs
+unsigned int stream_ready_jobs(CHUNK_STREAMER* streamer, CHUNK_STAGE first_stage, CHUNK_STAGE last_stage, unsigned int* num_working)
+{
+    unsigned int num_jobs = 0;
+    for(unsigned int i = 0; i < streamer->num_slots; i++)
+    {
+        STREAM_SLOT* slot = streamer->slots + i;
+        if(!slot->in_use) continue;
+        CHUNK_STAGE stage = stream_job_stage(streamer, slot);
+        if(stage < first_stage || stage > last_stage) continue;
+        if(slot->working) num_working[stage]++;
+        else if(stream_stage_ready(streamer, slot)) push_stream_job(streamer, &num_jobs, (STREAM_JOB){ .slot = slot, .stage = stage, .priority = slot->priority, .distance = slot->distance });
+    }
+    return num_jobs;
+}
+
+// Frees the slot of a chunk which isn't needed any more, wherever it is in the stages
+void cancel_stream_slot(CHUNK_STREAMER* streamer, STREAM_SLOT* slot)
+{
+    if(slot->prefetched) streamer->stats.prefetch_misses++;
+    streamer->stats.chunks_cancelled++;
+    slot->in_use = false;
+}
+
+// Takes every slot the workers have finished a stage for since the last call, and queues each for its next stage (or frees it, if it was cancelled)
+void take_finished_stream_slots(CHUNK_STREAMER* streamer)
+{
+    STREAM_SLOT* slot = SDL_AtomicSetPtr(&(streamer->finished_slots), NULL);
+    while(slot)
+    {
+        STREAM_SLOT* next = slot->next_finished;
+        slot->working = false;
+        if(SDL_AtomicGet(&(slot->cancelled))) cancel_stream_slot(streamer, slot);
+        else if(slot->stage != CHUNK_STAGE_DONE) finish_stream_stage(streamer, slot);
+        slot = next;
+    }
+}
+
+// Adds a request for every chunk in range of a centre which isn't being generated yet (skipping the ones in range of the camera, when prefetching).
+// Also notes whether any chunk in front of the camera isn't finished
+unsigned int stream_request_missing(CHUNK_STREAMER* streamer, CAMERA* camera, int centre_x, int centre_z, bool prefetching, unsigned int num_requests, bool* visible_missing)
+{
+    for(int z = centre_z - streamer->radius; z <= centre_z + streamer->radius; z++)
+    {
+        for(int x = centre_x - streamer->radius; x <= centre_x + streamer->radius; x++)
+        {
+            if(prefetching && stream_in_range(streamer, streamer->centre_x, streamer->centre_z, x, z)) continue;
+            STREAM_SLOT* slot = find_stream_slot(streamer, x, z);
+            bool visible = !prefetching && stream_chunk_visible(streamer, camera, x, z);
+            if(visible && (!slot || slot->stage != CHUNK_STAGE_DONE)) *visible_missing = true;
+            if(slot) continue;
+
+            STREAM_REQUEST* request = streamer->requests + num_requests++;
+            request->chunk_x = x;
+            request->chunk_z = z;
+            request->distance = sqrtf((float)((x - centre_x) * (x - centre_x) + (z - centre_z) * (z - centre_z)));
+            if(prefetching) request->priority = STREAM_PRIORITY_PREFETCH;
+            else request->priority = visible ? STREAM_PRIORITY_VISIBLE : STREAM_PRIORITY_NEARBY;
+        }
+    }
+    return num_requests;
+}
+
+// Works out which chunks are needed for where the camera is now, and where it is about to be, queues the most important of them, and starts every stage
+// but uploading (which upload_streamed_chunks does) on the chunks ready for it. This never waits for the stages to finish. Call this once every frame
+void update_streaming(CHUNK_STREAMER* streamer, CAMERA* camera, double elapsed_time)
+{
+    take_finished_stream_slots(streamer);
+
+    // The velocity is the average over the last few frames, which smooths out uneven frame times
+    streamer->time += elapsed_time;
+    streamer->camera_history[streamer->history_next] = camera->position;
+    streamer->history_times[streamer->history_next] = streamer->time;
+    streamer->history_next = (streamer->history_next + 1) % STREAM_HISTORY_SIZE;
+    if(streamer->history_length < STREAM_HISTORY_SIZE) streamer->history_length++;
+    unsigned int oldest = streamer->history_length < STREAM_HISTORY_SIZE ? 0 : streamer->history_next;
+    double history_time = streamer->time - streamer->history_times[oldest];
+    streamer->velocity = history_time > 0 ? vec3_divide_scalar(vec3_subtract_vec3(camera->position, streamer->camera_history[oldest]), history_time) : v3(0, 0, 0);
+
+    vec3 predicted = vec3_add_vec3(camera->position, vec3_multiply_scalar(streamer->velocity, STREAM_PREFETCH_TIME));
+    streamer->centre_x = stream_chunk_x(camera->position.x);
+    streamer->centre_z = stream_chunk_z(camera->position.z);
+    streamer->predicted_x = stream_chunk_x(predicted.x);
+    streamer->predicted_z = stream_chunk_z(predicted.z);
+    streamer->camera_section = (int)floorf(camera->position.y / CHUNK_SIZE);
+
+    // Every chunk's priority is worked out again, and the unfinished ones which aren't in range of the camera or where it is about to be are cancelled
+    for(unsigned int i = 0; i < streamer->num_slots; i++)
+    {
+        STREAM_SLOT* slot = streamer->slots + i;
+        if(!slot->in_use) continue;
+        bool in_range = stream_in_range(streamer, streamer->centre_x, streamer->centre_z, slot->chunk_x, slot->chunk_z);
+        if(!in_range && slot->stage != CHUNK_STAGE_DONE && !stream_in_range(streamer, streamer->predicted_x, streamer->predicted_z, slot->chunk_x, slot->chunk_z))
+        {
+            if(slot->working) SDL_AtomicSet(&(slot->cancelled), 1);
+            else cancel_stream_slot(streamer, slot);
+            continue;
+        }
+        if(in_range && slot->prefetched)
+        {
+            slot->prefetched = false;
+            streamer->stats.prefetch_hits++;
+        }
+
+        int centre_x = in_range ? streamer->centre_x : streamer->predicted_x, centre_z = in_range ? streamer->centre_z : streamer->predicted_z;
+        slot->distance = sqrtf((float)((slot->chunk_x - centre_x) * (slot->chunk_x - centre_x) + (slot->chunk_z - centre_z) * (slot->chunk_z - centre_z)));
+        if(!in_range) slot->priority = STREAM_PRIORITY_PREFETCH;
+        else slot->priority = stream_chunk_visible(streamer, camera, slot->chunk_x, slot->chunk_z) ? STREAM_PRIORITY_VISIBLE : STREAM_PRIORITY_NEARBY;
+    }
+
+    bool visible_missing = false;
+    unsigned int num_requests = stream_request_missing(streamer, camera, streamer->centre_x, streamer->centre_z, false, 0, &visible_missing);
+    if(streamer->predicted_x != streamer->centre_x || streamer->predicted_z != streamer->centre_z)
+        num_requests = stream_request_missing(streamer, camera, streamer->predicted_x, streamer->predicted_z, true, num_requests, &visible_missing);
+    qsort(streamer->requests, num_requests, sizeof(STREAM_REQUEST), compare_stream_requests);
+    streamer->stats.frames++;
+    if(visible_missing) streamer->stats.frames_missing_visible++;
+
+    // Only as many chunks are started as the terrain stage can take, so that chunks aren't queued long before they can be generated
+    unsigned int num_queued = 0;
+    for(unsigned int i = 0; i < streamer->num_slots; i++) num_queued += streamer->slots[i].in_use && streamer->slots[i].stage == CHUNK_STAGE_TERRAIN;
+    for(unsigned int i = 0; i < num_requests && num_queued < streamer->stage_budgets[CHUNK_STAGE_TERRAIN]; i++)
+    {
+        STREAM_REQUEST* request = streamer->requests + i;
+        STREAM_SLOT* slot = stream_free_slot(streamer, request->priority);
+        if(!slot) continue;
+        if(slot->in_use && slot->prefetched) streamer->stats.prefetch_misses++;
+
+        *slot = (STREAM_SLOT){ .streamer = streamer, .chunk = slot->chunk, .chunk_x = request->chunk_x, .chunk_z = request->chunk_z, .in_use = true, .stage = CHUNK_STAGE_TERRAIN,
+                               .prefetched = request->priority == STREAM_PRIORITY_PREFETCH, .priority = request->priority, .distance = request->distance,
+                               .stage_queued_time = SDL_GetPerformanceCounter() };
+        if(slot->prefetched) streamer->stats.chunks_prefetched++;
+        streamer->stats.chunks_generated++;
+        num_queued++;
+    }
+
+    // The jobs are spawned most important first, and the workers take the oldest tasks first, so they run in order of priority too. Once a job is spawned
+    // its priority can't change though, so only a few jobs for each worker (STREAM_JOBS_AHEAD) are spawned ahead of the ones running - the rest wait in
+    // the heap, and are put in order again next frame. The neighbours' borders are copied before a model is built, since they can't be touched from the workers
+    unsigned int max_waiting = (thread_pool.num_workers ? thread_pool.num_workers : 1) * STREAM_JOBS_AHEAD;
+    unsigned int num_working[NUM_CHUNK_STAGES] = { 0 };
+    unsigned int num_jobs = stream_ready_jobs(streamer, CHUNK_STAGE_TERRAIN, CHUNK_STAGE_MESH, num_working);
+    while(num_jobs)
+    {
+        if((unsigned int)SDL_AtomicGet(&(streamer->jobs_waiting)) >= max_waiting) break;
+        STREAM_JOB job = pop_stream_job(streamer, &num_jobs);
+        STREAM_SLOT* slot = job.slot;
+        if(num_working[job.stage] >= streamer->stage_budgets[job.stage]) continue;
+        num_working[job.stage]++;
+        for(unsigned char side = 0; job.stage == CHUNK_STAGE_MESH && side < 4; side++)
+        {
+            if(slot->stage != CHUNK_STAGE_DONE) copy_chunk_border(slot->chunk, side, stream_border_neighbour(streamer, slot, side));
+            else if(stream_border_outdated(streamer, slot, side))
+            {
+                copy_chunk_border(slot->chunk, side, stream_border_neighbour(streamer, slot, side));
+                slot->chunk->model_outdated = true;
+            }
+        }
+        if(slot->stage == CHUNK_STAGE_DONE) slot->required_sections = stream_missing_sections(streamer, slot);
+        slot->working = true;
+        SDL_AtomicAdd(&(streamer->jobs_waiting), 1);
+        spawn_task(&(streamer->working), run_stream_task, slot);
+    }
+}
+
+// Uploads the chunks which have been built, the most important first, until the upload stage's budget of chunks, time or bytes for the frame is used up.
+// The rest are left for the next frames. At least one chunk is always uploaded if there are any, so that a chunk bigger than the byte budget still gets through.
+// Only call this from the thread which owns the opengl context
+void upload_streamed_chunks(CHUNK_STREAMER* streamer)
+{
+    unsigned int num_working[NUM_CHUNK_STAGES] = { 0 }, num_uploaded = 0;
+    unsigned int num_jobs = stream_ready_jobs(streamer, CHUNK_STAGE_UPLOAD, CHUNK_STAGE_UPLOAD, num_working);
+    Uint64 start_time = SDL_GetPerformanceCounter();
+    double upload_time = 0;
+    size_t bytes_uploaded = 0;
+    while(num_jobs && num_uploaded < streamer->stage_budgets[CHUNK_STAGE_UPLOAD])
+    {
+        size_t upload_size = chunk_upload_size(streamer->jobs[0].slot->chunk);
+        if(num_uploaded && (upload_time * 1000 >= streamer->upload_time_budget || bytes_uploaded + upload_size > streamer->upload_byte_budget)) break;
+        STREAM_SLOT* slot = pop_stream_job(streamer, &num_jobs).slot;
+        if(slot->stage == CHUNK_STAGE_DONE)
+        {
+            upload_chunk(slot->chunk);
+            slot->rebuilt = false;
+            streamer->stats.chunks_rebuilt++;
+        }
+        else
+        {
+            run_stream_job(slot);
+            finish_stream_stage(streamer, slot);
+        }
+        bytes_uploaded += upload_size;
+        num_uploaded++;
+        upload_time = (double)(SDL_GetPerformanceCounter() - start_time) / SDL_GetPerformanceFrequency();
+    }
+
+    STREAM_STATS* stats = &(streamer->stats);
+    stats->upload_backlog += num_jobs;
+    if(num_jobs > stats->max_upload_backlog) stats->max_upload_backlog = num_jobs;
+    if(!num_uploaded) return;
+    stats->upload_frames++;
+    stats->bytes_uploaded += bytes_uploaded;
+    stats->upload_time += upload_time;
+    if(upload_time > stats->max_upload_time) stats->max_upload_time = upload_time;
+    if(upload_time * 1000 > streamer->upload_time_budget) stats->upload_hitches++;
+}
+
+void print_streaming_stats(CHUNK_STREAMER* streamer)
+{
+    STREAM_STATS* stats = &(streamer->stats);
+    printf("Chunk streaming: %lu chunks generated (%lu prefetched, %lu cancelled, %lu rebuilt), prefetch hit rate %.1lf%% (%lu hits, %lu reused before being reached), "
+           "visible chunks missing in %lu of %lu frames\n", stats->chunks_generated, stats->chunks_prefetched, stats->chunks_cancelled, stats->chunks_rebuilt,
+           stats->chunks_prefetched ? 100.0 * stats->prefetch_hits / stats->chunks_prefetched : 0.0, stats->prefetch_hits, stats->prefetch_misses,
+           stats->frames_missing_visible, stats->frames);
+    printf("Chunk uploads: %.1lf MB in %lu frames (%.2lf ms on average, %.2lf ms at most), over the time budget in %lu frames, "
+           "backlog of %.1lf chunks on average (%lu at most)\n", stats->bytes_uploaded / (1024.0 * 1024.0), stats->upload_frames,
+           stats->upload_frames ? 1000 * stats->upload_time / stats->upload_frames : 0.0, 1000 * stats->max_upload_time, stats->upload_hitches,
+           stats->frames ? (double)stats->upload_backlog / stats->frames : 0.0, stats->max_upload_backlog);
+
+    // The gpu memory of the finished chunks, under both ways of drawing quads, whichever one is in use
+    unsigned long num_chunks = 0;
+    size_t memory[NUM_QUAD_RENDERING_MODES] = { 0 }, index_memory = 0;
+    for(unsigned int i = 0; i < streamer->num_slots; i++)
+    {
+        STREAM_SLOT* slot = streamer->slots + i;
+        if(!slot->in_use || slot->stage != CHUNK_STAGE_DONE || slot->working) continue;
+        for(unsigned int mode = 0; mode < NUM_QUAD_RENDERING_MODES; mode++) memory[mode] += chunk_model_memory(slot->chunk, mode);
+        index_memory += slot->chunk->index_region.width * slot->chunk->index_region.height;
+        num_chunks++;
+    }
+    printf("Chunk memory (drawing %s, textured with %s): %.1lf KB per chunk with vertices (plus %.1lf MB of shared quad indices), %.1lf KB per chunk pulled, "
+           "and %.1lf KB of the index atlas per chunk, over %lu chunks (the whole atlas is %.1lf MB, %.1lf%% handed out)\n", quad_rendering_names[quad_rendering], block_texturing_names[block_texturing],
+           num_chunks ? memory[QUAD_RENDERING_VERTICES] / (1024.0 * num_chunks) : 0.0, (quad_index_capacity ? quad_index_capacity : QUAD_INDEX_INITIAL_QUADS) * 6 * sizeof(unsigned int) / (1024.0 * 1024.0),
+           num_chunks ? memory[QUAD_RENDERING_PULLED] / (1024.0 * num_chunks) : 0.0, num_chunks ? index_memory / (1024.0 * num_chunks) : 0.0, num_chunks,
+           index_atlas_memory() / (1024.0 * 1024.0), index_atlas_layers ? 100.0 * index_atlas_allocated_texels / index_atlas_memory() : 0.0);
+
+    // One row per stage, with the number of chunks in each latency bucket - each column is headed by the latency the bucket goes up to
+    printf("Stage latency (ms)");
+    for(unsigned int bucket = 0; bucket < STREAM_LATENCY_BUCKETS - 1; bucket++) printf(" %7g", 0.125 * (1 << bucket));
+    printf("    more\n");
+    for(unsigned int stage = 0; stage < NUM_CHUNK_STAGES; stage++)
+    {
+        printf("%-18s", chunk_stage_names[stage]);
+        for(unsigned int bucket = 0; bucket < STREAM_LATENCY_BUCKETS; bucket++) printf(" %7lu", stats->stage_latencies[stage][bucket]);
+        printf("\n");
+    }
+}
+
+// Waits for the stages still running, then frees the streamer along with the chunk buffer
+void unload_chunk_streamer(CHUNK_STREAMER* streamer)
+{
+    wait_for_group(&(streamer->working));
+    unload_chunk_buffer();
+    free(streamer->slots);
+    free(streamer->requests);
+    free(streamer->jobs);
+    free(streamer);
+}
+
+// Everything out to the LOD radius around the camera is drawn as LOD chunks wherever there isn't a chunk, which get coarser in rings the further they are
+// from the camera's chunk. Each LOD chunk position has a fixed slot, wrapping around every side chunks in each direction, so the cells leaving one
+// side of the square as the camera moves are recycled for the cells coming in on the other side. Cells whose ring changes are generated again
+typedef struct LOD_SLOT
+{
+    struct LOD_STREAMER* streamer;
+    LOD_CHUNK* lod_chunk;
+    int chunk_x, chunk_z;
+    unsigned int decimation;
+    bool in_use; // Set once something has been generated into the slot
+    bool working; // Set from when the LOD chunk is started until it has been uploaded. Nothing else touches the LOD chunk while the worker has it
+    SDL_atomic_t generated; // Set by the worker once the LOD chunk is ready to be uploaded
+} LOD_SLOT;
+
+typedef struct LOD_STREAMER
+{
+    int radius;
+    unsigned int side, chunks_per_frame;
+    LOD_SLOT* slots;
+    WAIT_GROUP working;
+    int centre_x, centre_z;
+} LOD_STREAMER;
+
+// Sets up a streamer for the LOD chunks up to radius chunks away from the camera (in a square), starting at most chunks_per_frame of them each frame
+LOD_STREAMER* make_lod_streamer(int radius, unsigned int chunks_per_frame)
+{
+    LOD_STREAMER* to_return = calloc(1, sizeof(LOD_STREAMER));
+    to_return->radius = radius;
+    to_return->side = radius * 2 + 1;
+    to_return->chunks_per_frame = chunks_per_frame ? chunks_per_frame : 1;
+    to_return->slots = calloc(to_return->side * to_return->side, sizeof(LOD_SLOT));
+    for(unsigned int i = 0; i < to_return->side * to_return->side; i++)
+    {
+        to_return->slots[i].streamer = to_return;
+        to_return->slots[i].lod_chunk = allocate_lod_chunk();
+    }
+    return to_return;
+}
+
+// The slot the LOD chunk at some chunk coordinates goes in
+LOD_SLOT* lod_stream_slot(LOD_STREAMER* streamer, int chunk_x, int chunk_z)
+{
+    int side = streamer->side, x = ((chunk_x % side) + side) % side, z = ((chunk_z % side) + side) % side;
+    return streamer->slots + (z * side) + x;
+}
+
+// The decimation of the LOD chunks in a ring around the camera's chunk: the finest in the first third of the radius, then each third half as fine again
+unsigned int lod_ring_decimation(LOD_STREAMER* streamer, int ring) { return ring * 3 <= streamer->radius ? 2 : ring * 3 <= streamer->radius * 2 ? 4 : 8; }
+
+void generate_lod_slot(void* lod_slot)
+{
+    LOD_SLOT* slot = (LOD_SLOT*)lod_slot;
+    make_lod_chunk(v3(slot->chunk_x * CHUNK_SIZE, 0, slot->chunk_z * CHUNK_SIZE), slot->decimation, slot->lod_chunk);
+    SDL_AtomicSet(&(slot->generated), 1);
+}
+
+// Uploads the LOD chunks which have been generated since the last call, then starts the ones around the camera which are missing or have the wrong
+// decimation, from the camera's chunk outwards. Only call this from the thread which owns the opengl context, once every frame
+void update_lod_streaming(LOD_STREAMER* streamer, CAMERA* camera)
+{
+    for(unsigned int i = 0; i < streamer->side * streamer->side; i++)
+    {
+        LOD_SLOT* slot = streamer->slots + i;
+        if(!slot->working || !SDL_AtomicGet(&(slot->generated))) continue;
+        upload_lod_chunk(slot->lod_chunk);
+        slot->working = false;
+    }
+
+    streamer->centre_x = stream_chunk_x(camera->position.x);
+    streamer->centre_z = stream_chunk_z(camera->position.z);
+    unsigned int num_started = 0;
+    for(int ring = 0; ring <= streamer->radius && num_started < streamer->chunks_per_frame; ring++)
+    {
+        unsigned int decimation = lod_ring_decimation(streamer, ring);
+        for(int z = streamer->centre_z - ring; z <= streamer->centre_z + ring && num_started < streamer->chunks_per_frame; z++)
+        {
+            for(int x = streamer->centre_x - ring; x <= streamer->centre_x + ring && num_started < streamer->chunks_per_frame; x++)
+            {
+                if(abs(x - streamer->centre_x) != ring && abs(z - streamer->centre_z) != ring) continue;
+                LOD_SLOT* slot = lod_stream_slot(streamer, x, z);
+                if(slot->working || (slot->in_use && slot->chunk_x == x && slot->chunk_z == z && slot->decimation == decimation)) continue;
+                *slot = (LOD_SLOT){ .streamer = streamer, .lod_chunk = slot->lod_chunk, .chunk_x = x, .chunk_z = z, .decimation = decimation, .in_use = true, .working = true };
+                spawn_task(&(streamer->working), generate_lod_slot, slot);
+                num_started++;
+            }
+        }
+    }
+}
+
+// Draws the LOD chunks in range of the camera, other than where the chunk streamer has a finished chunk
+void render_streamed_lod_chunks(LOD_STREAMER* streamer, CHUNK_STREAMER* chunk_streamer)
+{
+    for(unsigned int i = 0; i < streamer->side * streamer->side; i++)
+    {
+        LOD_SLOT* slot = streamer->slots + i;
+        if(!slot->in_use || slot->working || !slot->lod_chunk->finalised) continue;
+        if(abs(slot->chunk_x - streamer->centre_x) > streamer->radius || abs(slot->chunk_z - streamer->centre_z) > streamer->radius) continue;
+        if(!streamed_chunk(chunk_streamer, slot->chunk_x, slot->chunk_z)) render_lod_chunk(slot->lod_chunk);
+    }
+}
+
+void unload_lod_streamer(LOD_STREAMER* streamer)
+{
+    wait_for_group(&(streamer->working));
+    for(unsigned int i = 0; i < streamer->side * streamer->side; i++) unload_lod_chunk(streamer->slots[i].lod_chunk);
+    free(streamer->slots);
+    free(streamer);
+}
+
+#endif
\ No newline at end of file
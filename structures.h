@@ -0,0 +1,37 @@
+#ifndef STRUCTURES_H
+#define STRUCTURES_H
+#include<stdbool.h>
+#include"blocks.h"
+
+// Structures (trees, boulders and so on) are built by the preprocessor into templates of blocks, in several variants of each type.
+// The templates are compiled into the program, so that generating a chunk only has to pick a variant and copy its blocks into place.
+// Data layout: one offset (from the start of the data) per structure, then each template header followed by its blocks
+#define NUM_STRUCTURE_TYPES 3
+#define NUM_STRUCTURES 24 // The total number of variants, over all the types of structures
+#define STRUCTURE_MAX_SIZE 16 // The maximum width, height and depth of a structure template, in number of blocks
+typedef enum { TREE_STRUCTURE, BUSH_STRUCTURE, BOULDER_STRUCTURE } STRUCTURE_TYPE;
+const char* structure_names[] = { "Tree", "Bush", "Boulder" };
+const unsigned int structure_variants[] = { 16, 4, 4 }; // How many variants there are of each type of structure
+const bool structure_needs_soil[] = { true, true, false }; // Whether the structure can only be placed on grass or soil, rather than on any solid block
+
+typedef struct STRUCTURE_TEMPLATE
+{
+    unsigned char width, height, depth; // The size of the template along the x, y and z axes
+    unsigned char anchor_x, anchor_z; // The column of the template which is placed on the block at the top of the ground - the bottom layer of the template replaces that block
+    unsigned char blocks[]; // Indexed by x + (z * width) + (y * width * depth), with z going away from the front of the structure. EMPTY means the existing block is kept
+} STRUCTURE_TEMPLATE;
+
+extern char _binary_build_structures_start[];
+extern char _binary_build_structures_end[];
+extern char _binary_build_structures_size[];
+
+#ifndef ONLY_INCLUDE_DEFINITIONS
+// Returns the template for a variant of a type of structure, from the data built into the program
+const STRUCTURE_TEMPLATE* get_structure(STRUCTURE_TYPE type, unsigned int variant)
+{
+    unsigned int index = variant % structure_variants[type];
+    for(unsigned int i = 0; i < type; i++) index += structure_variants[i];
+    return (const STRUCTURE_TEMPLATE*)(_binary_build_structures_start + ((unsigned long*)_binary_build_structures_start)[index]);
+}
+#endif
+#endif
\ No newline at end of file
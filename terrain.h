@@ -0,0 +1,253 @@
+#ifndef TERRAIN_H
+#define TERRAIN_H
+#include<math.h>
+#include"util.h"
+#include"noise.h"
+
+#define TERRAIN_NOISE_FREQUENCY 0.05 // How quickly the terrain noise changes per block - lower values give wider hills and valleys
+#define TERRAIN_HEIGHT_SCALE 40 // How far above the base level the terrain can reach, in number of blocks
+#define TERRAIN_MAX_LATTICE_SIZE 33 // The maximum number of lattice points along one side of a chunk (a lattice step of 1 on a 32 block chunk, plus the far edge)
+#define TERRAIN_MAX_LATTICE_POINTS TERRAIN_MAX_LATTICE_SIZE * TERRAIN_MAX_LATTICE_SIZE
+#define TERRAIN_OCTAVE_OFFSET 17.0 // Each octave samples a different slice of the 3D noise, so that the octaves aren't correlated with each other
+#define TERRAIN_DENSITY_FALLOFF 16.0f // How many blocks it takes for the density to change by one away from the surface - higher values give more overhangs
+#define TERRAIN_OVERHANG_FREQUENCY 0.03 // How quickly the noise which bends the surface into overhangs changes per block
+#define TERRAIN_CAVE_FREQUENCY 0.045 // How quickly the cave noise changes per block horizontally (caves change twice as fast vertically, so they are flatter)
+#define TERRAIN_CAVE_OFFSET 1000.0 // The cave noise is sampled far away from the terrain noise, so that caves don't follow the hills
+#define TERRAIN_CAVE_FLOOR 4 // Caves are never carved below this height, so that the bottom of the world stays solid
+#define TERRAIN_MIN_DENSITY_STEP 4 // The smallest lattice step used for density terrain, which keeps the size of the 3D lattice reasonable
+#define TERRAIN_CAVE_STEP 2 // The lattice step used for the cave noise, which has to be finer than the density lattice for the thin cave sheets to keep their shape
+#define TERRAIN_CAVE_LATTICE_SIZE 17 // The number of cave lattice points along each side of a chunk section (a 32 block section at the cave step, plus the far edge)
+
+typedef struct TERRAIN_SETTINGS
+{
+    unsigned int lattice_step; // The distance between noise samples, in blocks. Higher values evaluate less noise but give smoother, less detailed terrain
+    unsigned int octaves; // The number of layers of noise added together - each one adds finer detail on top of the previous ones
+    float lacunarity, gain; // How much the frequency is multiplied by, and the amplitude is multiplied by, for each successive octave
+    bool ridged; // Ridged terrain folds each octave around zero, which gives sharp crests instead of rounded hills
+    bool density_terrain; // Generates the terrain from a 3D density field rather than a heightmap, which allows for caves and overhangs
+    float cave_threshold; // How close to zero the cave noise has to be for a block to be carved out - higher values give wider caves, and 0 disables caves
+} TERRAIN_SETTINGS;
+
+TERRAIN_SETTINGS terrain_settings = { .lattice_step = 4, .octaves = 4, .lacunarity = 2.0f, .gain = 0.5f, .ridged = false, .density_terrain = false, .cave_threshold = 0.08f };
+
+// The lattice step has to divide the area being generated evenly, so this rounds it down to the nearest power of two that does
+unsigned int terrain_lattice_step(unsigned int width)
+{
+    unsigned int step = 1;
+    while(step * 2 <= terrain_settings.lattice_step && width % (step * 2) == 0) step *= 2;
+    return step;
+}
+
+// Maps a single octave's noise value to its contribution to the terrain, keeping it in the range -1 to 1
+double terrain_octave_shape(double value)
+{
+    if(!terrain_settings.ridged) return value;
+    double ridge = 1.0 - fabs(value);
+    return ridge * ridge * 2.0 - 1.0;
+}
+
+// The height above the base level for a fractal noise value in the range -1 to 1, once scaled and offset (by the climate) at that point
+float terrain_scaled_height(double value, float height_scale, float height_offset) { return height_offset + (fmin(fmax(value, -1.0), 1.0) + 1.0) / 2.0 * TERRAIN_HEIGHT_SCALE * height_scale; }
+
+// How closely terrain_height_lattice has to refine the height at each lattice point
+typedef enum
+{
+    TERRAIN_EXACT_HEIGHTS, // Every octave is added at every point, for when the heights are used as they are rather than rounded to whole blocks
+    TERRAIN_POINT_BLOCKS, // Only the whole block height at each point has to come out right, for when the points are the only columns used
+    TERRAIN_COLUMN_BLOCKS // The whole block height of every column interpolated between the points has to come out right, as in terrain_heightmap
+} TERRAIN_PRECISION;
+
+// Interpolates the lattice bilinearly between corner and the three points after it, the same way for every caller so that the results match exactly
+float terrain_interpolate(const float* corner, unsigned int points_per_side, float fraction_u, float fraction_v)
+{
+    float near_row = corner[0] + (corner[1] - corner[0]) * fraction_u;
+    float far_row = corner[points_per_side] + (corner[points_per_side + 1] - corner[points_per_side]) * fraction_u;
+    return near_row + (far_row - near_row) * fraction_v;
+}
+
+// Whether every column interpolated within the cell at (a, b) has the same whole block height for the lowest and highest heights its corners could still end up at
+bool terrain_cell_settled(const float* lowest, const float* highest, unsigned int a, unsigned int b, unsigned int step, unsigned int points_per_side) // Internal
+{
+    unsigned int corner = (b * points_per_side) + a;
+    for(unsigned int j = 0; j < step; j++)
+        for(unsigned int i = 0; i < step; i++)
+        {
+            float fraction_u = (float)i / step, fraction_v = (float)j / step;
+            if(floorf(terrain_interpolate(lowest + corner, points_per_side, fraction_u, fraction_v)) != floorf(terrain_interpolate(highest + corner, points_per_side, fraction_u, fraction_v))) return false;
+        }
+    return true;
+}
+
+// Evaluates the terrain height above the base level at every point of a coarse lattice, points_per_side points along each side step blocks apart, starting at (u, v)
+// in noise space. The fractal noise at each point is scaled and offset by height_scales and height_offsets, which have one value per lattice point.
+// Each octave is evaluated for all the points still being refined, and unless the exact heights are needed a point stops being refined once the remaining octaves
+// can't move any column that depends on it across a block boundary. With TERRAIN_COLUMN_BLOCKS that is every column of the (up to) four cells around the point -
+// since an interpolated column is a weighted average of its corners, it lies between the columns interpolated from its corners' lowest and highest possible heights.
+// The heights left unrefined are only good to the block, so use TERRAIN_EXACT_HEIGHTS anywhere the fraction of a block matters
+void terrain_height_lattice(float* lattice, float u, float v, const float* height_scales, const float* height_offsets, unsigned int step, unsigned int points_per_side, TERRAIN_PRECISION precision)
+{
+    double x[TERRAIN_MAX_LATTICE_POINTS], y[TERRAIN_MAX_LATTICE_POINTS], values[TERRAIN_MAX_LATTICE_POINTS], sums[TERRAIN_MAX_LATTICE_POINTS] = { 0 };
+    float lowest[TERRAIN_MAX_LATTICE_POINTS], highest[TERRAIN_MAX_LATTICE_POINTS];
+    bool cell_settled[TERRAIN_MAX_LATTICE_POINTS] = { 0 };
+    unsigned int active[TERRAIN_MAX_LATTICE_POINTS], num_points = points_per_side * points_per_side, num_active = num_points;
+    for(unsigned int i = 0; i < num_points; i++) active[i] = i;
+
+    double total_amplitude = 0, amplitude = 1.0, frequency = TERRAIN_NOISE_FREQUENCY;
+    for(unsigned int octave = 0; octave < terrain_settings.octaves; octave++, amplitude *= terrain_settings.gain) total_amplitude += amplitude;
+
+    double remaining_amplitude = total_amplitude;
+    amplitude = 1.0;
+    for(unsigned int octave = 0; octave < terrain_settings.octaves && num_active; octave++)
+    {
+        for(unsigned int i = 0; i < num_active; i++)
+        {
+            x[i] = (u + (active[i] % points_per_side) * step) * frequency;
+            y[i] = (v + (active[i] / points_per_side) * step) * frequency;
+        }
+        simplex_noise_points(x, y, octave * TERRAIN_OCTAVE_OFFSET, values, num_active);
+        remaining_amplitude -= amplitude;
+        for(unsigned int i = 0; i < num_active; i++)
+        {
+            unsigned int point = active[i];
+            sums[point] += terrain_octave_shape(values[i]) * amplitude;
+            lowest[point] = terrain_scaled_height((sums[point] - remaining_amplitude) / total_amplitude, height_scales[point], height_offsets[point]);
+            highest[point] = terrain_scaled_height((sums[point] + remaining_amplitude) / total_amplitude, height_scales[point], height_offsets[point]);
+        }
+
+        // The bounds of every point only ever narrow, so a settled cell stays settled, and only cells with a corner still being refined need checking. Points which
+        // have stopped being refined keep the bounds they stopped with, which their final height is always within
+        if(precision == TERRAIN_COLUMN_BLOCKS)
+            for(unsigned int i = 0; i < num_active; i++)
+            {
+                unsigned int a = active[i] % points_per_side, b = active[i] / points_per_side;
+                for(unsigned int cell_b = b ? b - 1 : 0; cell_b <= b && cell_b < points_per_side - 1; cell_b++)
+                    for(unsigned int cell_a = a ? a - 1 : 0; cell_a <= a && cell_a < points_per_side - 1; cell_a++)
+                    {
+                        bool* settled = cell_settled + (cell_b * points_per_side) + cell_a;
+                        if(!*settled) *settled = terrain_cell_settled(lowest, highest, cell_a, cell_b, step, points_per_side);
+                    }
+            }
+
+        // Keep only the points where the octaves left could still change a block height
+        unsigned int still_active = 0;
+        for(unsigned int i = 0; i < num_active; i++)
+        {
+            unsigned int point = active[i], a = point % points_per_side, b = point / points_per_side;
+            bool settled = precision == TERRAIN_POINT_BLOCKS && floorf(lowest[point]) == floorf(highest[point]);
+            if(precision == TERRAIN_COLUMN_BLOCKS)
+            {
+                settled = true;
+                for(unsigned int cell_b = b ? b - 1 : 0; cell_b <= b && cell_b < points_per_side - 1; cell_b++)
+                    for(unsigned int cell_a = a ? a - 1 : 0; cell_a <= a && cell_a < points_per_side - 1; cell_a++) settled = settled && cell_settled[(cell_b * points_per_side) + cell_a];
+            }
+            if(!settled) active[still_active++] = point;
+        }
+
+        num_active = still_active;
+        frequency *= terrain_settings.lacunarity;
+        amplitude *= terrain_settings.gain;
+    }
+
+    for(unsigned int i = 0; i < num_points; i++)
+        lattice[i] = terrain_scaled_height(sums[i] / total_amplitude, height_scales[i], height_offsets[i]);
+}
+
+// Fills heights (width x width, row-major with the row being the v coordinate) with the terrain height above the base level for each column.
+// The noise is only evaluated on the lattice (see terrain_height_lattice, which the scales and offsets are passed on to), and every column in between
+// is interpolated bilinearly from the four lattice points surrounding it. The heights are only good to the block
+void terrain_heightmap(float* heights, float u, float v, const float* height_scales, const float* height_offsets, unsigned int width)
+{
+    float lattice[TERRAIN_MAX_LATTICE_POINTS];
+    unsigned int step = terrain_lattice_step(width), points_per_side = width / step + 1;
+    if(points_per_side > TERRAIN_MAX_LATTICE_SIZE) exit_with_error("Could not generate terrain", "the area is too large for the noise lattice");
+    terrain_height_lattice(lattice, u, v, height_scales, height_offsets, step, points_per_side, TERRAIN_COLUMN_BLOCKS);
+
+    for(unsigned int j = 0; j < width; j++)
+        for(unsigned int i = 0; i < width; i++)
+            heights[j * width + i] = terrain_interpolate(lattice + ((j / step) * points_per_side) + (i / step), points_per_side, (float)(i % step) / step, (float)(j % step) / step);
+}
+
+// The step used for the 3D density lattice - like terrain_lattice_step, but never smaller than TERRAIN_MIN_DENSITY_STEP
+unsigned int terrain_density_step(unsigned int width)
+{
+    unsigned int step = terrain_lattice_step(width);
+    while(step < TERRAIN_MIN_DENSITY_STEP && width % (step * 2) == 0) step *= 2;
+    return step;
+}
+
+// Evaluates the terrain density on a coarse 3D lattice starting at height y, laid out as lattice[(y * points_per_side + v) * points_per_side + u]. Positive values are solid.
+// The height of the surface at each lattice point is scaled and offset by height_scales and height_offsets, which are laid out like the 2D lattice
+// The density falls off with the distance above the fractal surface, and is bent by 3D noise to form overhangs. Caves are carved out separately (see terrain_cave_lattice)
+void terrain_density_lattice(float* lattice, float u, float v, float y, float base_level, const float* height_scales, const float* height_offsets, unsigned int step, unsigned int points_per_side, unsigned int points_high)
+{
+    float surface[TERRAIN_MAX_LATTICE_POINTS];
+    terrain_height_lattice(surface, u, v, height_scales, height_offsets, step, points_per_side, TERRAIN_EXACT_HEIGHTS);
+    for(unsigned int layer = 0; layer < points_high; layer++)
+    {
+        double world_y = y + layer * step;
+        for(unsigned int b = 0; b < points_per_side; b++)
+        {
+            double world_v = v + b * step;
+            for(unsigned int a = 0; a < points_per_side; a++)
+            {
+                double world_u = u + a * step;
+                float surface_height = base_level + surface[b * points_per_side + a];
+                float density = (surface_height - world_y) / TERRAIN_DENSITY_FALLOFF;
+                density += simplex_noise(world_u * TERRAIN_OVERHANG_FREQUENCY, world_y * TERRAIN_OVERHANG_FREQUENCY, world_v * TERRAIN_OVERHANG_FREQUENCY);
+                lattice[(layer * points_per_side + b) * points_per_side + a] = density;
+            }
+        }
+    }
+}
+
+// Evaluates the cave noise on a 3D lattice laid out like the density lattice. Caves are the thin sheets where the cave noise crosses zero, so the lattice
+// keeps the noise's sign and the threshold is only applied to each block once it has been interpolated (see terrain_cave_at) - interpolating the distance
+// from zero instead would lose any sheet which passes between two lattice points
+void terrain_cave_lattice(float* lattice, float u, float v, float y, unsigned int step, unsigned int points_per_side, unsigned int points_high)
+{
+    for(unsigned int layer = 0; layer < points_high; layer++)
+    {
+        double world_y = y + layer * step;
+        for(unsigned int b = 0; b < points_per_side; b++)
+            for(unsigned int a = 0; a < points_per_side; a++)
+            {
+                double world_u = u + a * step, world_v = v + b * step;
+                lattice[(layer * points_per_side + b) * points_per_side + a] = simplex_noise(world_u * TERRAIN_CAVE_FREQUENCY + TERRAIN_CAVE_OFFSET, world_y * TERRAIN_CAVE_FREQUENCY * 2, world_v * TERRAIN_CAVE_FREQUENCY);
+            }
+    }
+}
+
+// Interpolates the density lattice trilinearly at the block (u, y, v), in blocks from the start of the lattice
+float terrain_density_at(const float* lattice, unsigned int step, unsigned int points_per_side, unsigned int u, unsigned int y, unsigned int v)
+{
+    float fraction_u = (float)(u % step) / step, fraction_y = (float)(y % step) / step, fraction_v = (float)(v % step) / step;
+    const float* corner = lattice + ((y / step) * points_per_side + (v / step)) * points_per_side + (u / step);
+    const float* above = corner + points_per_side * points_per_side;
+    float near_bottom = corner[0] + (corner[1] - corner[0]) * fraction_u;
+    float far_bottom = corner[points_per_side] + (corner[points_per_side + 1] - corner[points_per_side]) * fraction_u;
+    float near_top = above[0] + (above[1] - above[0]) * fraction_u;
+    float far_top = above[points_per_side] + (above[points_per_side + 1] - above[points_per_side]) * fraction_u;
+    float bottom = near_bottom + (far_bottom - near_bottom) * fraction_v;
+    float top = near_top + (far_top - near_top) * fraction_v;
+    return bottom + (top - bottom) * fraction_y;
+}
+
+// Finds the smallest and largest lattice values that blocks from y_min up to (but not including) y_max are interpolated from.
+// Since every block is a weighted average of the lattice points around it, no block in the range can be outside of these bounds
+void terrain_density_bounds(const float* lattice, unsigned int step, unsigned int points_per_side, unsigned int y_min, unsigned int y_max, float* lowest, float* highest)
+{
+    *lowest = INFINITY; *highest = -INFINITY;
+    for(unsigned int i = (y_min / step) * points_per_side * points_per_side; i < ((y_max - 1) / step + 2) * points_per_side * points_per_side; i++)
+    {
+        if(lattice[i] < *lowest) *lowest = lattice[i];
+        if(lattice[i] > *highest) *highest = lattice[i];
+    }
+}
+
+// Whether the block (u, y, v) of a cave lattice, in blocks from the start of the lattice, is carved out. world_y is the block's height in the world
+bool terrain_cave_at(const float* lattice, unsigned int step, unsigned int points_per_side, unsigned int u, unsigned int y, unsigned int v, unsigned int world_y)
+{
+    return terrain_settings.cave_threshold > 0 && world_y >= TERRAIN_CAVE_FLOOR && fabsf(terrain_density_at(lattice, step, points_per_side, u, y, v)) < terrain_settings.cave_threshold;
+}
+
+#endif
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include<stdio.h>
 #include<stdlib.h>
 #include<stdbool.h>
+#include<string.h>
 
 #ifdef _WIN32
     #ifdef DEBUG // Only need to include the full windows API in debug mode
@@ -13,6 +14,7 @@
 #include<profileapi.h>
 #define TIME_T LARGE_INTEGER
 #else
+#include<SDL2/SDL.h>
 #define TIME_T unsigned long long
 #endif
 
@@ -83,7 +85,11 @@ void open_console_window()
 
 void initialise_timer()
 {
+    #ifdef _WIN32
     QueryPerformanceFrequency(&frequency);
+    #else
+    frequency = SDL_GetPerformanceFrequency();
+    #endif
     memset(&last_frame_time, 0, sizeof(TIME_T));
 }
 
@@ -96,7 +102,8 @@ double get_elapsed_time()
     last_frame_time = current_time;
     #else
     current_time = SDL_GetPerformanceCounter();
-    double elapsed_time = (((*current_time) - (*last_frame_time)) * 1000) / (*frequency);
+    double elapsed_time = (double)(current_time - last_frame_time) / frequency;
+    last_frame_time = current_time;
     #endif
     return elapsed_time;
 }
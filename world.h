@@ -1,22 +1,38 @@
 #ifndef WORLD_H
 #define WORLD_H
 #include<stdlib.h>
+#include<stdint.h>
 #include<SDL2/SDL.h>
 #include<glad/glad.h>
 
 #include"util.h"
 #include"noise.h"
+#include"terrain.h"
+#include"biomes.h"
+#include"random.h"
+#include"pending_writes.h"
 #include"math3d.h"
 #include"blocks.h"
 #include"rendering.h"
+#include"index_atlas.h"
 
+// Chunks are full height columns, kept and streamed by their x and z alone, so CHUNK_MAX_HEIGHT is as high as the world goes. Inside a column, each section
+// only takes up memory (and generation time) once it has more than one type of block in it, and with density terrain, sections deep underground are left as
+// solid stone until the camera comes near them (see require_chunk_section and the chunk streamer). Heightmap terrain has nothing under its surface but stone,
+// so its sections are all generated straight away - the ones below the surface are uniform, and the ones above it are empty, which both cost next to nothing
 #define CHUNK_SIZE 32 // The maximum width and depth of chunks, in number of blocks
 #define CHUNK_MAX_HEIGHT 256 // The maximum height of chunks, in number of blocks
+#define CHUNK_SECTIONS (CHUNK_MAX_HEIGHT / CHUNK_SIZE) // Chunks are split vertically into cubic sections, which are stored and generated separately
+#define CHUNK_SECTION_BLOCKS (CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE) // The number of blocks in each section
+#define CHUNK_TREE_NODE_BLOCK_SIZE 4096 // The number of fill state tree nodes allocated at once - a chunk only allocates as many of these as its trees need
+#define CHUNK_MAX_TREE_NODE_BLOCKS (CHUNK_SECTION_BLOCKS * CHUNK_SECTIONS * 2 / CHUNK_TREE_NODE_BLOCK_SIZE)
 #define CHUNK_INITIAL_ALLOC_BLOCKS 4096 // The number of blocks to allocate vertex & index space for when a chunk is created. Increasing this reduces the number of allocations, but uses more memory
-#define CHUNK_INDEX_TEXTURE_SIZE 2048 // The size of the texture used to store the indices which specify the texture to use for each cube
+#define CHUNK_INDEX_TEXTURE_WIDTH 512 // The width of a chunk's index texture, which stores the texture to use for each block on each quad - its region of the index atlas is at most this wide
+#define CHUNK_INDEX_TEXTURE_HEIGHT 2048 // The most rows a chunk's index texture can have, which is as far as the vertices can point into it
 
 #define BASE_LEVEL CHUNK_SIZE * 3 // This is the height at which water will be generated, and which any terrain will be added on, meaning that all chunks under this will be completely filled in
 #define WATER_LEVEL 13 // How far up from the base level water should reach
+#define UNDERGROUND_SECTION_DEPTH 16 // Sections of density terrain which are at least this far below the lowest point of the surface are only generated once they are needed
 
 typedef enum { CUBE_FACE_FRONT = 0b00000001,  CUBE_FACE_BACK   = 0b00000010, 
                CUBE_FACE_LEFT  = 0b00000100,  CUBE_FACE_RIGHT  = 0b00001000, 
@@ -42,13 +58,37 @@ typedef struct CHUNK
     mat4 tranform;
     vec3 position;
     MODEL* model, *transparency_model; // A separate temporary model is used for transparent object, which will be added on to the end of the terrain model so that transparency works properly
-    unsigned int index_texture, index_texture_offset_x, index_texture_offset_y, index_texture_highest_y_offset;
-    unsigned long cube_child_buffer_size;
-    GLuint* index_texture_data;
-    CUBE* cubes;
-    CUBE_TREE cube_fill_state[8], transparency_fill_state[8], *cube_child_buffer, *trees_to_update[256];
+    unsigned int index_texture_offset_x, index_texture_offset_y, index_texture_highest_y_offset;
+    unsigned int index_texture_columns_used; // How far along its rows the index texture has been filled in, which is as wide as its region of the index atlas needs to be
+    INDEX_REGION index_region; // Where the rows of the index texture in use were last uploaded to in the index atlas
+    unsigned long num_tree_nodes;
+    unsigned char* index_texture_data;
+    CUBE* sections[CHUNK_SECTIONS]; // The blocks of each section, which are only allocated once the section has more than one type of block in it
+    CUBE uniform_cubes[CHUNK_SECTIONS]; // The block every cube in a section is, for sections without any blocks allocated
+    unsigned char generated_sections; // One bit for each section - sections which haven't been generated yet are treated as solid stone
+    unsigned char stale_transparency_trees; // One bit for each section whose transparency tree still has leaves in it which structures have since covered with solid blocks
+    bool model_outdated; // Set when the chunk changes after its models have been built, so they are built again before it is next rendered
+    unsigned char border_blocks[4][CHUNK_MAX_HEIGHT * CHUNK_SIZE]; // The blocks just outside the front, back, left and right of the chunk, copied from its neighbours
+    unsigned char borders_known; // One bit for each side whose neighbour was there to copy the border from - faces on the other sides are kept
+    unsigned char border_sections[4]; // The neighbour's generated sections when each border was copied
+    PENDING_CHUNK* pending; // Blocks which structures in neighbouring chunks spilled into this one
+    PENDING_WRITE* applied_writes; // The newest of the pending writes which have already been applied to the chunk
+    CUBE_TREE cube_fill_state[CHUNK_SECTIONS], transparency_fill_state[CHUNK_SECTIONS], *tree_node_blocks[CHUNK_MAX_TREE_NODE_BLOCKS], *trees_to_update[256];
 } CHUNK;
 
+// The binary mesher finds the same faces as the greedy mesher, but works on whole columns of blocks at once
+typedef enum { CHUNK_MESHER_GREEDY, CHUNK_MESHER_BINARY, NUM_CHUNK_MESHERS } CHUNK_MESHER;
+const char* chunk_mesher_names[] = { "greedy", "binary" };
+CHUNK_MESHER chunk_mesher = CHUNK_MESHER_BINARY; // Which mesher builds the chunks' models
+
+// Where the fragment shader finds the texture of each block on a face. With an index texture, every chunk has a texture holding the texture of each block
+// on each of its quads, which is looked up for every fragment. Both meshers only ever merge faces with the same texture though, so with face layers the
+// layer in the block texture array simply goes in each quad's vertices instead, and chunks don't have an index texture at all. This has to be chosen
+// before any chunks are made, along with the fragment shader to match (block-fragment or block-layer-fragment)
+typedef enum { BLOCK_TEXTURING_INDEX_TEXTURE, BLOCK_TEXTURING_FACE_LAYERS, NUM_BLOCK_TEXTURING_MODES } BLOCK_TEXTURING;
+const char* block_texturing_names[] = { "index texture", "face layers" };
+BLOCK_TEXTURING block_texturing = BLOCK_TEXTURING_INDEX_TEXTURE;
+
 CHUNK **chunks;
 CUBE empty_cube = { 0 };
 const vec3 full_chunk = { CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE };
@@ -79,9 +119,13 @@ unsigned int cube_face_back[]   = { 4, 6, 5, 5, 6, 7 };
 unsigned int cube_face_left[]   = { 4, 5, 0, 0, 5, 1 };
 unsigned int cube_face_right[]  = { 2, 3, 6, 6, 3, 7 };
 unsigned int cube_face_top[]    = { 1, 5, 3, 3, 5, 7 };
-unsigned int cube_face_bottom[] = { 0, 2, 6, 6, 4, 0 };
+unsigned int cube_face_bottom[] = { 2, 6, 0, 0, 6, 4 };
 unsigned int* faces[] = { cube_face_front, cube_face_back, cube_face_left, cube_face_right, cube_face_top, cube_face_bottom };
 
+// Every face above joins up its four corners in the same pattern as the shared quad index buffer, (0, 1, 2), (2, 1, 3) - so these are where each corner
+// first turns up in a face, which is the order the corners are added to models in
+unsigned int quad_corners[] = { 0, 1, 2, 5 };
+
 // For each of the vertices above, which texcoord to use (by index, from the list above) when rendering the given face
 unsigned int front_face_coords[]   = { 0, 1, 2, 3, 0, 0, 0, 0 };
 unsigned int back_face_coords[]    = { 0, 0, 0, 0, 2, 3, 0, 1 };
@@ -125,6 +169,18 @@ CUBE_TREE* cube_tree_find(CUBE_TREE* tree, vec3 position, bool stop_at_first_mat
     }
 }
 
+// Takes a new node for one of the chunk's fill state trees. Nodes are allocated in blocks as the trees grow, so a chunk with simple terrain only uses a few blocks
+CUBE_TREE* allocate_tree_node(CHUNK* chunk)
+{
+    unsigned long block = chunk->num_tree_nodes / CHUNK_TREE_NODE_BLOCK_SIZE;
+    if(block >= CHUNK_MAX_TREE_NODE_BLOCKS) exit_with_error("Could not generate chunk", "ran out of space for the fill state trees");
+    if(!chunk->tree_node_blocks[block] && !(chunk->tree_node_blocks[block] = malloc(CHUNK_TREE_NODE_BLOCK_SIZE * sizeof(CUBE_TREE))))
+        exit_with_error("Memory allocation error", "malloc() failed while allocating fill state tree nodes");
+    CUBE_TREE* node = chunk->tree_node_blocks[block] + (chunk->num_tree_nodes++ % CHUNK_TREE_NODE_BLOCK_SIZE);
+    memset(node, 0, sizeof(CUBE_TREE));
+    return node;
+}
+
 void cube_tree_fill(CHUNK* chunk, CUBE_TREE* tree, vec3 position)
 {
     CUBE_TREE* cursor = tree;
@@ -142,7 +198,7 @@ void cube_tree_fill(CHUNK* chunk, CUBE_TREE* tree, vec3 position)
         if(!cursor->children[idx])
         {
             // fprintf(stderr, "%u\n", idx);
-            cursor->children[idx] = chunk->cube_child_buffer + chunk->cube_child_buffer_size++;
+            cursor->children[idx] = allocate_tree_node(chunk);
             cursor->children[idx]->min = vec3_add_vec3(cursor->min, vec3_scale(size, tree_child_transformations[idx]));
             cursor->children[idx]->size = size;
             // printf("min: %f %f %f\n", cursor->children[idx]->min.x, cursor->children[idx]->min.y, cursor->children[idx]->min.z);
@@ -177,6 +233,48 @@ void cube_tree_empty(CHUNK* chunk, CUBE_TREE* tree, vec3 position)
 
 }
 
+// Fills a whole range of blocks in every column at once, from bottoms[column] up to (but not including) tops[column], where column = (-z * CHUNK_SIZE) + x.
+// Instead of walking down the tree for each block, each node checks the ranges of the columns it covers: if they all cover it, the node is marked full 
+// without creating any children, and if none of them reach it, it is left alone. Only the nodes in between are split up, so this visits far fewer nodes
+CHUNK_FILL_STATE cube_tree_fill_columns(CHUNK* chunk, CUBE_TREE* tree, const unsigned short* bottoms, const unsigned short* tops)
+{
+    if(tree->full == CHUNK_FULL) return CHUNK_FULL;
+    unsigned int x_min = tree->min.x, y_min = tree->min.y, z_min = -tree->min.z, size = tree->size.x;
+    bool covered = true, reached = false;
+    for(unsigned int z = z_min; z < z_min + size; z++)
+    {
+        for(unsigned int x = x_min; x < x_min + size; x++)
+        {
+            unsigned int column = (z * CHUNK_SIZE) + x;
+            if(bottoms[column] > y_min || tops[column] < y_min + size) covered = false;
+            if(bottoms[column] < y_min + size && tops[column] > y_min) reached = true;
+        }
+    }
+
+    if(covered) return tree->full = CHUNK_FULL;
+    if(!reached) return tree->full;
+
+    // Children are only taken from the buffer once it's known that some of the columns reach them
+    vec3 child_size = vec3_divide_scalar(tree->size, 2);
+    unsigned int num_full = 0;
+    for(unsigned char i = 0; i < 8; i++)
+    {
+        CHUNK_FILL_STATE child_state;
+        if(tree->children[i]) child_state = cube_tree_fill_columns(chunk, tree->children[i], bottoms, tops);
+        else
+        {
+            CUBE_TREE child = { .full = CHUNK_EMPTY, .min = vec3_add_vec3(tree->min, vec3_scale(child_size, tree_child_transformations[i])), .size = child_size };
+            if((child_state = cube_tree_fill_columns(chunk, &child, bottoms, tops)) != CHUNK_EMPTY)
+            {
+                tree->children[i] = allocate_tree_node(chunk);
+                *(tree->children[i]) = child;
+            }
+        }
+        if(child_state == CHUNK_FULL) num_full++;
+    }
+    return tree->full = (num_full == 8 ? CHUNK_FULL : CHUNK_PARTIALLY_FULL);
+}
+
 void load_block_textures()
 {
     glGenTextures(1, &block_textures);
@@ -194,43 +292,90 @@ void load_block_textures()
     glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
 }
 
-BLOCK_VERTEX cube_vertex(CHUNK* chunk, unsigned char position_index, unsigned char face_index, vec3 place_at, vec3 size) 
-{ 
-    BLOCK_VERTEX to_return;
-    to_return.position = vec3_add_vec3(vec3_scale(cube_vertex_positions[position_index], size), place_at);
+// Returns the index of the texture, in the block texture array, to use for one face of a block
+unsigned int block_face_texture(BLOCK_TYPE type, unsigned char face_index) { return block_face_textures[type] ? (unsigned int)block_face_textures[type][face_index] : type - 1; }
 
-    vec2 face_uv_scale;
+// The width and height of a face of a box of blocks, in blocks - along face_u_axes and face_v_axes
+vec2 face_uv_scale(unsigned char face_index, vec3 size)
+{
     CUBE_FACES face = 1 << face_index;
-    if(face == CUBE_FACE_FRONT || face == CUBE_FACE_BACK) face_uv_scale = v2(size.x, size.y);
-    else if(face == CUBE_FACE_LEFT || face == CUBE_FACE_RIGHT) face_uv_scale = v2(size.z, size.y);
-    else if (face == CUBE_FACE_TOP || face == CUBE_FACE_BOTTOM) face_uv_scale = v2(size.x, size.z);
+    if(face == CUBE_FACE_FRONT || face == CUBE_FACE_BACK) return v2(size.x, size.y);
+    else if(face == CUBE_FACE_LEFT || face == CUBE_FACE_RIGHT) return v2(size.z, size.y);
+    return v2(size.x, size.z);
+}
 
-    to_return.uv = vec2_scale_vec2(cube_texcoords[face_texcoords[face_index][position_index]], face_uv_scale);
-    to_return.uv2 = v2(chunk->index_texture_offset_x, chunk->index_texture_offset_y);
-    return to_return;
+// Makes the vertex for one corner of a face of a box of blocks. The texture coordinates count blocks along the face, so each block gets its own copy of the texture,
+// and index_offset is where the texture indices for the blocks on the face start in the index texture
+BLOCK_VERTEX block_vertex(unsigned char position_index, unsigned char face_index, vec3 place_at, vec3 size, vec2 index_offset)
+{
+    vec3 position = vec3_add_vec3(vec3_scale(cube_vertex_positions[position_index], size), place_at);
+    return pack_block_vertex(position, vec2_scale_vec2(cube_texcoords[face_texcoords[face_index][position_index]], face_uv_scale(face_index, size)), index_offset, face_index);
+}
+
+// Makes the packed face which a pulled quad model stores instead of the four vertices from block_vertex. Its position is the corner of the face nearest the origin,
+// which for the back, right and top faces is on the far side of the box
+BLOCK_VERTEX block_face(unsigned char face_index, vec3 place_at, vec3 size, vec2 index_offset)
+{
+    CUBE_FACES face = 1 << face_index;
+    if(face == CUBE_FACE_BACK) place_at.z -= size.z;
+    else if(face == CUBE_FACE_RIGHT) place_at.x += size.x;
+    else if(face == CUBE_FACE_TOP) place_at.y += size.y;
+    return pack_block_vertex(place_at, face_uv_scale(face_index, size), index_offset, face_index);
 }
 
+// Adds one face of a box of blocks to a quad model, as its four corners or, if the model is pulled, as one packed face. The model must already have room for it
+void add_block_face(MODEL* to_fill, unsigned char face_index, vec3 place_at, vec3 size, vec2 index_offset)
+{
+    if(to_fill->pulled) ((BLOCK_VERTEX*)to_fill->vertices)[to_fill->num_vertices++] = block_face(face_index, place_at, size, index_offset);
+    else
+    {
+        for(unsigned char j = 0; j < 4; j++)
+            ((BLOCK_VERTEX*)to_fill->vertices)[to_fill->num_vertices++] = block_vertex(faces[face_index][quad_corners[j]], face_index, place_at, size, index_offset);
+    }
+    to_fill->num_indices += 6;
+}
+
+// Converts a position along the x or z axis into the index of the chunk containing it
+int chunk_coordinate(float position) { return (int)floorf(position / CHUNK_SIZE); }
+
+// Returns the blocks of a section, allocating them (all set to the section's uniform block) if the section doesn't have any yet
+CUBE* chunk_section(CHUNK* chunk, unsigned int section)
+{
+    if(chunk->sections[section]) return chunk->sections[section];
+    if(!(chunk->sections[section] = calloc(CHUNK_SECTION_BLOCKS, sizeof(CUBE)))) exit_with_error("Memory allocation error", "calloc() failed while allocating a chunk section");
+    if(chunk->uniform_cubes[section].type != EMPTY)
+        for(unsigned int i = 0; i < CHUNK_SECTION_BLOCKS; i++) chunk->sections[section][i].type = chunk->uniform_cubes[section].type;
+    return chunk->sections[section];
+}
+
+// Returns the cube at a point in the chunk. For sections without any blocks allocated this is the section's uniform block, so it should only be read from
 CUBE* get_cube(CHUNK* parent_chunk, vec3 point)
 {
     long long x = (long long)point.x, y = (long long)point.y, z = (long long)point.z;
-    if(x < 0 || y < 0 || x >= CHUNK_SIZE || y >= CHUNK_MAX_HEIGHT || z > 0 || abs(z) >= CHUNK_SIZE)
+    if(x < 0 || y < 0 || x >= CHUNK_SIZE || y >= CHUNK_MAX_HEIGHT || z > 0 || -z >= CHUNK_SIZE)
         return &empty_cube;
-    return parent_chunk->cubes + (x + (abs(z) * CHUNK_SIZE) + (y * CHUNK_SIZE * CHUNK_SIZE));
+    if(!parent_chunk->sections[y / CHUNK_SIZE]) return parent_chunk->uniform_cubes + (y / CHUNK_SIZE);
+    return parent_chunk->sections[y / CHUNK_SIZE] + (x + (-z * CHUNK_SIZE) + ((y % CHUNK_SIZE) * CHUNK_SIZE * CHUNK_SIZE));
+}
+
+// Like get_cube, but allocates the blocks of the section first so that the cube can be changed
+CUBE* edit_cube(CHUNK* parent_chunk, vec3 point)
+{
+    long long y = (long long)point.y;
+    if(y >= 0 && y < CHUNK_MAX_HEIGHT) chunk_section(parent_chunk, y / CHUNK_SIZE);
+    return get_cube(parent_chunk, point);
 }
 
+// Makes sure a chunk's quad model has room for capacity_cutoff more vertices. Its indices are all in the shared quad index buffer, so only the vertices grow
 void expand_chunk_model(MODEL* to_expand, int capacity_cutoff)
 {
-    if(to_expand->num_vertices + capacity_cutoff > to_expand->vertex_capacity || to_expand->num_indices + capacity_cutoff > to_expand->index_capacity)
+    if(to_expand->num_vertices + capacity_cutoff > to_expand->vertex_capacity)
     {
-        // Allocate more space for vertices and indices. Since there are more indices than vertices per cube, the number of indices grows faster as well
-        BLOCK_VERTEX* vertices; unsigned int* indices;
+        BLOCK_VERTEX* vertices;
         if((vertices = realloc(to_expand->vertices, to_expand->vertex_capacity * 2 * sizeof(BLOCK_VERTEX))) == NULL)
             exit_with_error("Memory allocation error", "realloc() failed during chunk generation - likely run out of memory");
-        if((indices = realloc(to_expand->indices, to_expand->index_capacity * 4 * sizeof(unsigned int))) == NULL)
-            exit_with_error("Memory allocation error", "realloc() failed during chunk generation - likely ran out of memory");
         to_expand->vertex_capacity *= 2;
-        to_expand->index_capacity *= 4;
-        to_expand->vertices = vertices; to_expand->indices = indices;
+        to_expand->vertices = vertices;
     }
 }
 
@@ -240,34 +385,36 @@ void cube_faces(CHUNK* parent_chunk, MODEL* to_fill, vec3 position, vec3 size, C
     vec3 fill_to;
     CUBE_FACES face_to_add;
     BLOCK_TYPE face_cube_type;
-    unsigned int num_vertices_added = 0, num_indices_added = 0, indices_added[8] = { 0 };
-    unsigned int next_index, *index_loc, offset_x, offset_y, x_limit, greatest_y_offset;
+    unsigned int offset_x, offset_y, x_limit, greatest_y_offset;
     for(unsigned char i = 0; i < 6; i++)
     {
         face_to_add = 1 << i;
         if(faces_to_add & face_to_add)
         {
-            // Copy the indices for the current face
-            index_loc = to_fill->indices + to_fill->num_indices + num_indices_added;
-            memcpy(index_loc, faces[i], sizeof(unsigned int) * 6);
-            memset(indices_added, 0, 8 * sizeof(unsigned int));
-
-            // Copy the corresponding vertices for all the indices
-            for(unsigned char j = 0; j < 6; j++)
+            // Every block on the face has the same texture as the one in the corner, so with face layers that is all the quad needs
+            if(block_texturing == BLOCK_TEXTURING_FACE_LAYERS)
             {
-                if(!indices_added[index_loc[j]])
-                {
-                    ((BLOCK_VERTEX*)to_fill->vertices)[to_fill->num_vertices + num_vertices_added++] = cube_vertex(parent_chunk, index_loc[j], i, position, size);
-                    indices_added[index_loc[j]] = to_fill->num_vertices + num_vertices_added - 1;
-                }
-                index_loc[j] = indices_added[index_loc[j]];
+                add_block_face(to_fill, i, position, size, v2(block_face_texture(get_cube(parent_chunk, position)->type, i), 0));
+                continue;
+            }
+            // A face which doesn't fit in what's left of the index texture's current row of faces starts the next one, instead of running off the edge
+            // of the texture (and into the start of the row below, over the indices of another face)
+            x_limit = (face_to_add & (CUBE_FACE_LEFT | CUBE_FACE_RIGHT)) ? size.z : size.x;
+            if(parent_chunk->index_texture_offset_x + x_limit > CHUNK_INDEX_TEXTURE_WIDTH)
+            {
+                parent_chunk->index_texture_offset_x = 0;
+                parent_chunk->index_texture_offset_y = parent_chunk->index_texture_offset_y + parent_chunk->index_texture_highest_y_offset + 1;
+                parent_chunk->index_texture_highest_y_offset = 0;
             }
-            num_indices_added += 6;
+            add_block_face(to_fill, i, position, size, v2(parent_chunk->index_texture_offset_x, parent_chunk->index_texture_offset_y));
 
             // Updates the index texture for the face by looping through each block on the face, and updating the texture coordinate with the block texture ID
             offset_x = parent_chunk->index_texture_offset_x;
             offset_y = parent_chunk->index_texture_offset_y;
             x_limit = size.x;
+
+            // A chunk with more faces than its index texture has room for (which terrain never comes close to) leaves out the indices of the ones past the end
+            if(offset_y + ((face_to_add & (CUBE_FACE_TOP | CUBE_FACE_BOTTOM)) ? size.z : size.y) > CHUNK_INDEX_TEXTURE_HEIGHT) face_to_add = 0;
             
             // I might move this into its own function in the future, but I think it would be tricky because of the number of variables involved
             // TODO: Clean this up
@@ -278,10 +425,9 @@ void cube_faces(CHUNK* parent_chunk, MODEL* to_fill, vec3 position, vec3 size, C
                 {
                     for(float x = position.x; x < position.x + size.x; x++)
                     {
-                        unsigned long index = (offset_y * CHUNK_INDEX_TEXTURE_SIZE) + offset_x++;
+                        unsigned long index = (offset_y * CHUNK_INDEX_TEXTURE_WIDTH) + offset_x++;
                         face_cube_type = get_cube(parent_chunk, at(x, y, position.z))->type;
-                        if(!block_face_textures[face_cube_type]) parent_chunk->index_texture_data[index] = face_cube_type - 1;
-                        else parent_chunk->index_texture_data[index] = block_face_textures[face_cube_type][i];
+                        parent_chunk->index_texture_data[index] = block_face_texture(face_cube_type, i);
                         if(offset_x == parent_chunk->index_texture_offset_x + x_limit) { offset_x = parent_chunk->index_texture_offset_x; offset_y++; }
                     }
                 }
@@ -293,10 +439,9 @@ void cube_faces(CHUNK* parent_chunk, MODEL* to_fill, vec3 position, vec3 size, C
                 {
                     for(float x = position.x + size.x - 1; x > position.x - 1; x--)
                     {
-                        unsigned long index = (offset_y * CHUNK_INDEX_TEXTURE_SIZE) + offset_x++;
+                        unsigned long index = (offset_y * CHUNK_INDEX_TEXTURE_WIDTH) + offset_x++;
                         face_cube_type = get_cube(parent_chunk, at(x, y, position.z - size.z + 1))->type;
-                        if(!block_face_textures[face_cube_type]) parent_chunk->index_texture_data[index] = face_cube_type - 1;
-                        else parent_chunk->index_texture_data[index] = block_face_textures[face_cube_type][i];
+                        parent_chunk->index_texture_data[index] = block_face_texture(face_cube_type, i);
                         if(offset_x == parent_chunk->index_texture_offset_x + x_limit) { offset_x = parent_chunk->index_texture_offset_x; offset_y++; }
                     }
                 }
@@ -309,10 +454,9 @@ void cube_faces(CHUNK* parent_chunk, MODEL* to_fill, vec3 position, vec3 size, C
                 {
                     for(float z = position.z - size.z + 1; z < position.z + 1; z++)
                     {
-                        unsigned long index = (offset_y * CHUNK_INDEX_TEXTURE_SIZE) + offset_x++;
+                        unsigned long index = (offset_y * CHUNK_INDEX_TEXTURE_WIDTH) + offset_x++;
                         face_cube_type = get_cube(parent_chunk, at(position.x, y, z))->type;
-                        if(!block_face_textures[face_cube_type]) parent_chunk->index_texture_data[index] = face_cube_type - 1;
-                        else parent_chunk->index_texture_data[index] = block_face_textures[face_cube_type][i];
+                        parent_chunk->index_texture_data[index] = block_face_texture(face_cube_type, i);
                         if(offset_x == parent_chunk->index_texture_offset_x + x_limit) { offset_x = parent_chunk->index_texture_offset_x; offset_y++; }
                     }
                 }
@@ -325,10 +469,9 @@ void cube_faces(CHUNK* parent_chunk, MODEL* to_fill, vec3 position, vec3 size, C
                 {
                     for(float z = position.z; z > position.z - size.z; z--)
                     {
-                        unsigned long index = (offset_y * CHUNK_INDEX_TEXTURE_SIZE) + offset_x++;
+                        unsigned long index = (offset_y * CHUNK_INDEX_TEXTURE_WIDTH) + offset_x++;
                         face_cube_type = get_cube(parent_chunk, at(position.x + size.x - 1, y, z))->type;
-                        if(!block_face_textures[face_cube_type]) parent_chunk->index_texture_data[index] = face_cube_type - 1;
-                        else parent_chunk->index_texture_data[index] = block_face_textures[face_cube_type][i];
+                        parent_chunk->index_texture_data[index] = block_face_texture(face_cube_type, i);
                         if(offset_x == parent_chunk->index_texture_offset_x + x_limit) { offset_x = parent_chunk->index_texture_offset_x; offset_y++; }
                     }
                 }
@@ -340,10 +483,9 @@ void cube_faces(CHUNK* parent_chunk, MODEL* to_fill, vec3 position, vec3 size, C
                 {
                     for(float x = position.x; x < position.x + size.x; x++)
                     {
-                        unsigned long index = (offset_y * CHUNK_INDEX_TEXTURE_SIZE) + offset_x++;
+                        unsigned long index = (offset_y * CHUNK_INDEX_TEXTURE_WIDTH) + offset_x++;
                         face_cube_type = get_cube(parent_chunk, at(x, position.y + size.y - 1, z))->type;
-                        if(!block_face_textures[face_cube_type]) parent_chunk->index_texture_data[index] = face_cube_type - 1;
-                        else parent_chunk->index_texture_data[index] = block_face_textures[face_cube_type][i];
+                        parent_chunk->index_texture_data[index] = block_face_texture(face_cube_type, i);
                         if(offset_x == parent_chunk->index_texture_offset_x + x_limit) { offset_x = parent_chunk->index_texture_offset_x; offset_y++; }
                     }
                 }
@@ -355,17 +497,17 @@ void cube_faces(CHUNK* parent_chunk, MODEL* to_fill, vec3 position, vec3 size, C
                 {
                     for(float x = position.x; x < position.x + size.x; x++)
                     {
-                        unsigned long index = (offset_y * CHUNK_INDEX_TEXTURE_SIZE) + offset_x++;
+                        unsigned long index = (offset_y * CHUNK_INDEX_TEXTURE_WIDTH) + offset_x++;
                         face_cube_type = get_cube(parent_chunk, at(x, position.y, z))->type;
-                        if(!block_face_textures[face_cube_type]) parent_chunk->index_texture_data[index] = face_cube_type - 1;
-                        else parent_chunk->index_texture_data[index] = block_face_textures[face_cube_type][i];
+                        parent_chunk->index_texture_data[index] = block_face_texture(face_cube_type, i);
                         if(offset_x == parent_chunk->index_texture_offset_x + x_limit) { offset_x = parent_chunk->index_texture_offset_x; offset_y++; }
                     }
                 }
             }
 
+            if(parent_chunk->index_texture_offset_x + x_limit > parent_chunk->index_texture_columns_used) parent_chunk->index_texture_columns_used = parent_chunk->index_texture_offset_x + x_limit;
             parent_chunk->index_texture_offset_x += x_limit + 1;
-            if(parent_chunk->index_texture_offset_x >= CHUNK_INDEX_TEXTURE_SIZE)
+            if(parent_chunk->index_texture_offset_x >= CHUNK_INDEX_TEXTURE_WIDTH)
             {
                 parent_chunk->index_texture_offset_x = 0;
                 parent_chunk->index_texture_offset_y = parent_chunk->index_texture_offset_y + parent_chunk->index_texture_highest_y_offset + 1;
@@ -374,8 +516,6 @@ void cube_faces(CHUNK* parent_chunk, MODEL* to_fill, vec3 position, vec3 size, C
         }
     }
 
-    to_fill->num_vertices += num_vertices_added;
-    to_fill->num_indices += num_indices_added;
 }
 
 vec3 top_cube(CHUNK* chunk, float x, float z)
@@ -394,46 +534,269 @@ vec3 raycast_block(CHUNK* chunk, vec3 origin, vec3 ray)
     return v3(-1, -1, -1);
 }
 
-// Generates the vertices and indices for a chunk based on its cube array.
+// Transparent blocks are kept in their own fill state trees, since faces next to them can still be seen
+bool transparent_block(BLOCK_TYPE type) { return type == WATER || type == LEAVES; }
+
+// The type of the block at (x, y, -z) in the chunk, or EMPTY for anywhere outside of it
+BLOCK_TYPE chunk_block_type(CHUNK* chunk, int x, int y, int z)
+{
+    if(x < 0 || y < 0 || z < 0 || x >= CHUNK_SIZE || y >= CHUNK_MAX_HEIGHT || z >= CHUNK_SIZE) return EMPTY;
+    CUBE* section = chunk->sections[y / CHUNK_SIZE];
+    return section ? section[x + (z * CHUNK_SIZE) + ((y % CHUNK_SIZE) * CHUNK_SIZE * CHUNK_SIZE)].type : chunk->uniform_cubes[y / CHUNK_SIZE].type;
+}
+
+// Whether the face of a block next to a neighbouring block can be seen, and so belongs in the model for opaque (or transparent) blocks.
+// Faces are hidden by opaque blocks, and by blocks of the same type - so the inside of a lake or a tree's leaves has no faces
+bool block_face_visible(BLOCK_TYPE type, BLOCK_TYPE neighbour, bool transparent)
+{
+    if(type == EMPTY || transparent_block(type) != transparent) return false;
+    return neighbour == EMPTY || (transparent_block(neighbour) && neighbour != type);
+}
+
+// Copies the blocks along one side of a neighbouring chunk (0 to 3 for front, back, left and right, as with the faces) into the chunk's border, so
+// that faces against it can be hidden. A NULL neighbour forgets the border instead. For the front and back, row y of the border is
+// [(y * CHUNK_SIZE) + x], and for the left and right it is [(y * CHUNK_SIZE) + z]
+void copy_chunk_border(CHUNK* chunk, unsigned char side, CHUNK* neighbour)
+{
+    chunk->borders_known &= ~(1 << side);
+    if(!neighbour) return;
+    for(int y = 0; y < CHUNK_MAX_HEIGHT; y++)
+    {
+        unsigned char* row = chunk->border_blocks[side] + (y * CHUNK_SIZE);
+        for(int i = 0; i < CHUNK_SIZE; i++)
+        {
+            if(side == 0) row[i] = chunk_block_type(neighbour, i, y, CHUNK_SIZE - 1);
+            else if(side == 1) row[i] = chunk_block_type(neighbour, i, y, 0);
+            else if(side == 2) row[i] = chunk_block_type(neighbour, CHUNK_SIZE - 1, y, i);
+            else row[i] = chunk_block_type(neighbour, 0, y, i);
+        }
+    }
+    chunk->borders_known |= 1 << side;
+    chunk->border_sections[side] = neighbour->generated_sections;
+}
+
+// The type of the block at (x, y, -z) in the chunk, where the coordinates can be one block outside of it. Past the sides, that's the neighbour's block
+// if the border is known and EMPTY if not (or at the corners, which never touch a face). Nothing is ever seen from below the world, so that counts as stone
+BLOCK_TYPE chunk_block_type_with_borders(CHUNK* chunk, int x, int y, int z)
+{
+    if(y < 0) return STONE;
+    if(y >= CHUNK_MAX_HEIGHT) return EMPTY;
+    unsigned char side = z < 0 ? 0 : z >= CHUNK_SIZE ? 1 : x < 0 ? 2 : x >= CHUNK_SIZE ? 3 : 4;
+    if(side == 4) return chunk_block_type(chunk, x, y, z);
+    if(!(chunk->borders_known & (1 << side)) || (side < 2 && (x < 0 || x >= CHUNK_SIZE))) return EMPTY;
+    return chunk->border_blocks[side][(y * CHUNK_SIZE) + (side < 2 ? x : z)];
+}
+
+// Copies the types of the blocks in a section, along with the blocks around it, into blocks - where (x, y, -z) relative to the section is at
+// ((y + 1) * (CHUNK_SIZE + 2) * (CHUNK_SIZE + 2)) + ((z + 1) * (CHUNK_SIZE + 2)) + (x + 1)
+void copy_section_blocks(CHUNK* chunk, unsigned int section, unsigned char* blocks)
+{
+    const unsigned int side = CHUNK_SIZE + 2;
+    for(int y = -1; y <= CHUNK_SIZE; y++)
+    {
+        int chunk_y = (section * CHUNK_SIZE) + y;
+        for(int z = -1; z <= CHUNK_SIZE; z++)
+        {
+            unsigned char* row = blocks + ((y + 1) * side * side) + ((z + 1) * side);
+            bool inside = y >= 0 && y < CHUNK_SIZE && z >= 0 && z < CHUNK_SIZE;
+            if(inside && !chunk->sections[section]) memset(row + 1, chunk->uniform_cubes[section].type, CHUNK_SIZE);
+            else if(inside) for(int x = 0; x < CHUNK_SIZE; x++) row[x + 1] = chunk->sections[section][x + (z * CHUNK_SIZE) + (y * CHUNK_SIZE * CHUNK_SIZE)].type;
+            else for(int x = 0; x < CHUNK_SIZE; x++) row[x + 1] = chunk_block_type_with_borders(chunk, x, chunk_y, z);
+            row[0] = chunk_block_type_with_borders(chunk, -1, chunk_y, z);
+            row[side - 1] = chunk_block_type_with_borders(chunk, CHUNK_SIZE, chunk_y, z);
+        }
+    }
+}
+
+// For each face, the axis it points along, and the two axes across it, where 0 is x, 1 is y and 2 is -z, and which way along the first axis it points
+const unsigned char face_normal_axes[] = { 2, 2, 0, 0, 1, 1 }, face_u_axes[] = { 0, 0, 2, 2, 0, 0 }, face_v_axes[] = { 1, 1, 1, 1, 2, 2 };
+const int face_normal_directions[] = { -1, 1, -1, 1, 1, -1 };
+
+// Adds a rectangle of faces, width by height from (u, v) in a slice through a section, to a model as a single quad - the rectangle becomes a box
+// one block thick, with only the face being added
+void add_face_rectangle(CHUNK* chunk, MODEL* to_fill, unsigned int section, unsigned char face, unsigned int slice, unsigned int u, unsigned int v, unsigned int width, unsigned int height)
+{
+    float min[3], size[3];
+    min[face_normal_axes[face]] = slice;
+    min[face_u_axes[face]] = u;
+    min[face_v_axes[face]] = v;
+    size[face_normal_axes[face]] = 1;
+    size[face_u_axes[face]] = width;
+    size[face_v_axes[face]] = height;
+    cube_faces(chunk, to_fill, v3(min[0], min[1] + (section * CHUNK_SIZE), -min[2]), v3(size[0], size[1], size[2]), 1 << face);
+}
+
+// Generates the vertices and indices for one of a chunk's models (and fills in its part of the index texture) with a greedy mesher. For each direction
+// a face can point in, each slice through each section is scanned for the faces which can be seen, and these are merged into the largest rectangles
+// of faces with the same texture, which then each only need a single quad. Sections without any blocks in the model's fill state trees are skipped
 void recalculate_chunk_model(CHUNK* to_recalculate, bool transparent)
 {
-    vec3 block_position;
-    int num_to_visit = 0;
-    CUBE_TREE* to_visit[1024] = { NULL };
-    unsigned int i = 1, range_min = 0, range_max = CHUNK_SIZE, level;
+    const unsigned int side = CHUNK_SIZE + 2, strides[] = { 1, side * side, side };
+    unsigned char blocks[(CHUNK_SIZE + 2) * (CHUNK_SIZE + 2) * (CHUNK_SIZE + 2)];
+    unsigned int mask[CHUNK_SIZE * CHUNK_SIZE]; // The texture of each face in the slice, plus one, so that 0 means there isn't a face there
+    unsigned int face_textures[6][NUM_BLOCK_TYPES + 1];
+    bool visible[NUM_BLOCK_TYPES + 1][NUM_BLOCK_TYPES + 1];
     MODEL* dst_model = (transparent ? to_recalculate->transparency_model : to_recalculate->model);
     CUBE_TREE* origin = (transparent ? to_recalculate->transparency_fill_state : to_recalculate->cube_fill_state);
-    for(unsigned int i = 0; i < CHUNK_MAX_HEIGHT / CHUNK_SIZE; i++)
+    for(unsigned int type = 0; type <= NUM_BLOCK_TYPES; type++)
     {
-        CUBE_TREE* cursor = origin + i;
-        if(cursor->full == CHUNK_FULL)
+        for(unsigned char face = 0; face < 6; face++) face_textures[face][type] = type == EMPTY ? 0 : block_face_texture(type, face) + 1;
+        for(unsigned int neighbour = 0; neighbour <= NUM_BLOCK_TYPES; neighbour++) visible[type][neighbour] = block_face_visible(type, neighbour, transparent);
+    }
+
+    for(unsigned int section = 0; section < CHUNK_SECTIONS; section++)
+    {
+        if(origin[section].full == CHUNK_EMPTY) continue;
+        copy_section_blocks(to_recalculate, section, blocks);
+        for(unsigned char face = 0; face < 6; face++)
         {
-            cube_faces(to_recalculate, dst_model, cursor->min, v3(CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE), CUBE_FACE_ALL & 0b11011111);
-            // printf("%f %f %f\n", cursor->size.x, cursor->size.y, cursor->size.z);
+            unsigned int normal_stride = strides[face_normal_axes[face]], u_stride = strides[face_u_axes[face]], v_stride = strides[face_v_axes[face]];
+            int neighbour_offset = face_normal_directions[face] * (int)normal_stride;
+            for(unsigned int slice = 0; slice < CHUNK_SIZE; slice++)
+            {
+                // Every block of a section without its own blocks is the same, so only the slice at its edge can have any faces which can be seen
+                if(!to_recalculate->sections[section] && slice != (face_normal_directions[face] < 0 ? 0 : CHUNK_SIZE - 1)) continue;
+                bool any_faces = false;
+                for(unsigned int v = 0; v < CHUNK_SIZE; v++)
+                {
+                    unsigned int block = (side * side) + side + 1 + (slice * normal_stride) + (v * v_stride);
+                    for(unsigned int u = 0; u < CHUNK_SIZE; u++, block += u_stride)
+                    {
+                        unsigned int texture = visible[blocks[block]][blocks[block + neighbour_offset]] ? face_textures[face][blocks[block]] : 0;
+                        mask[(v * CHUNK_SIZE) + u] = texture;
+                        any_faces |= texture != 0;
+                    }
+                }
+                if(!any_faces) continue;
+
+                for(unsigned int v = 0; v < CHUNK_SIZE; v++)
+                {
+                    for(unsigned int u = 0; u < CHUNK_SIZE;)
+                    {
+                        unsigned int texture = mask[(v * CHUNK_SIZE) + u], width = 1, height = 1;
+                        if(!texture) { u++; continue; }
+
+                        // Grow the rectangle as wide as it can go, then down for as long as the whole width of the next row matches
+                        while(u + width < CHUNK_SIZE && mask[(v * CHUNK_SIZE) + u + width] == texture) width++;
+                        for(; v + height < CHUNK_SIZE; height++)
+                        {
+                            unsigned int i = 0;
+                            while(i < width && mask[((v + height) * CHUNK_SIZE) + u + i] == texture) i++;
+                            if(i < width) break;
+                        }
+                        for(unsigned int j = 0; j < height; j++) memset(mask + ((v + j) * CHUNK_SIZE) + u, 0, width * sizeof(unsigned int));
+                        add_face_rectangle(to_recalculate, dst_model, section, face, slice, u, v, width, height);
+                        u += width;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Builds one of a chunk's models with the same faces and rectangles as recalculate_chunk_model, but finds the faces a whole row of blocks at a time.
+// Each row of a section along x (along with the block past each end of it, and the rows around the section) is a bit mask of the blocks of each type in it.
+// A face can be seen wherever a block in the model isn't next to a block which hides it, so for the faces pointing along y or z that is just
+// (row & ~hiders) against the next row along, and for the faces pointing along x it is (row & ~(hiders >> 1)) or (row & ~(hiders << 1)), which lines
+// every block up with its neighbour in the same row. The faces are sorted by texture into a 32 bit row for each row of each slice, and merged into rectangles
+// by finding runs of set bits with ctz. Opaque blocks hide every face, and transparent blocks only hide faces of their own type, so each type of transparent
+// block is meshed on its own
+void recalculate_chunk_model_binary(CHUNK* to_recalculate, bool transparent)
+{
+    const unsigned int side = CHUNK_SIZE + 2, strides[] = { 1, side * side, side };
+    const uint64_t inside_section = 0xFFFFFFFFULL << 1; // The bits of a row which are in the section, rather than its neighbours
+    unsigned char blocks[(CHUNK_SIZE + 2) * (CHUNK_SIZE + 2) * (CHUNK_SIZE + 2)];
+    uint64_t rows[NUM_BLOCK_TYPES + 1][(CHUNK_SIZE + 2) * (CHUNK_SIZE + 2)]; // The row at (y, -z) is [((y + 1) * (CHUNK_SIZE + 2)) + (z + 1)], and opaque blocks all go in EMPTY's rows
+    uint32_t faces[CHUNK_SIZE][CHUNK_SIZE]; // The faces pointing one way, where bit u of faces[slice][v] is the face at (u, v) in the slice
+    uint32_t texture_rows[NUM_BLOCK_TYPES + 1][CHUNK_SIZE]; // The faces in one slice, split up by texture
+    unsigned char texture_groups[6][NUM_BLOCK_TYPES + 1]; // For each face, the first block type with the same texture as each type, which their faces are merged under
+    unsigned char row_types[NUM_BLOCK_TYPES + 1]; // Which rows each type goes in - empty blocks go in a spare set, which is thrown away
+    MODEL* dst_model = (transparent ? to_recalculate->transparency_model : to_recalculate->model);
+    CUBE_TREE* origin = (transparent ? to_recalculate->transparency_fill_state : to_recalculate->cube_fill_state);
+    for(unsigned int type = 0; type <= NUM_BLOCK_TYPES; type++)
+    {
+        row_types[type] = type == EMPTY ? NUM_BLOCK_TYPES + 1 : transparent_block(type) ? type : EMPTY;
+        for(unsigned char face = 0; face < 6; face++)
+            for(texture_groups[face][type] = 0; texture_groups[face][type] < type; texture_groups[face][type]++)
+                if(texture_groups[face][type] != EMPTY && block_face_texture(texture_groups[face][type], face) == block_face_texture(type, face)) break;
+    }
+    memset(texture_rows, 0, sizeof(texture_rows));
+
+    for(unsigned int section = 0; section < CHUNK_SECTIONS; section++)
+    {
+        if(origin[section].full == CHUNK_EMPTY) continue;
+        copy_section_blocks(to_recalculate, section, blocks);
+        unsigned int types_present = 0;
+        for(unsigned int row = 0; row < side * side; row++)
+        {
+            uint64_t row_bits[NUM_BLOCK_TYPES + 2] = { 0 };
+            for(unsigned int x = 0; x < side; x++) row_bits[row_types[blocks[(row * side) + x]]] |= 1ULL << x;
+            for(unsigned int type = 0; type <= NUM_BLOCK_TYPES; type++) rows[type][row] = row_bits[type];
         }
-        else if(cursor->full == CHUNK_PARTIALLY_FULL)
+        for(unsigned int y = 1; y <= CHUNK_SIZE; y++)
+            for(unsigned int z = 1; z <= CHUNK_SIZE; z++)
+                for(unsigned int type = 0; type <= NUM_BLOCK_TYPES; type++) types_present |= (rows[type][(y * side) + z] & inside_section ? 1 : 0) << type;
+
+        // The opaque model is a single layer, in EMPTY's rows, and the transparent model has a layer for each transparent type
+        for(unsigned int layer = 0; layer <= NUM_BLOCK_TYPES; layer++)
         {
-            num_to_visit = 0;
-            while(cursor)
+            if(!(types_present & (1 << layer)) || (transparent ? layer == EMPTY || !transparent_block(layer) : layer != EMPTY)) continue;
+            uint64_t* layer_rows = rows[layer], *opaque_rows = rows[EMPTY];
+            for(unsigned char face = 0; face < 6; face++)
             {
-                if(cursor->full == CHUNK_FULL)
+                unsigned int axis = face_normal_axes[face], normal_stride = strides[axis], u_stride = strides[face_u_axes[face]], v_stride = strides[face_v_axes[face]];
+                int direction = face_normal_directions[face], next_row = axis == 1 ? direction * (int)side : axis == 2 ? direction : 0;
+                uint32_t any_faces = 0;
+                if(axis == 0) memset(faces, 0, sizeof(faces));
+                for(unsigned int y = 1; y <= CHUNK_SIZE; y++)
                 {
-                    // fprintf(stderr, "min: %f %f %f\n", cursor->min.x, cursor->min.y, cursor->min.z);
-                    // fprintf(stderr, "size: %f %f %f\n", cursor->size.x, cursor->size.y, cursor->size.z);
-                    cube_faces(to_recalculate, dst_model, cursor->min, cursor->size, CUBE_FACE_ALL);
-                    // printf("%f %f %f\n", cursor->size.x, cursor->size.y, cursor->size.z);
+                    for(unsigned int z = 1; z <= CHUNK_SIZE; z++)
+                    {
+                        unsigned int row = (y * side) + z;
+                        uint64_t hiders = opaque_rows[row + next_row] | layer_rows[row + next_row];
+                        if(axis == 0) hiders = direction > 0 ? hiders >> 1 : hiders << 1;
+                        uint32_t visible = (layer_rows[row] & ~hiders & inside_section) >> 1;
+                        any_faces |= visible;
+                        if(axis == 1) faces[y - 1][z - 1] = visible;
+                        else if(axis == 2) faces[z - 1][y - 1] = visible;
+                        else for(; visible; visible &= visible - 1) faces[__builtin_ctz(visible)][y - 1] |= 1U << (z - 1);
+                    }
                 }
-                else
+                if(!any_faces) continue;
+
+                for(unsigned int slice = 0; slice < CHUNK_SIZE; slice++)
                 {
-                    for(unsigned int j = 0; j < 8; j++)
-                        if(cursor->children[j]) to_visit[num_to_visit++] = cursor->children[j];
-                }
+                    // Every face in the slice is sorted by its texture, so that only faces with the same texture are merged
+                    unsigned int textures_used = 0;
+                    for(unsigned int v = 0; v < CHUNK_SIZE; v++)
+                    {
+                        unsigned int block = (side * side) + side + 1 + (slice * normal_stride) + (v * v_stride);
+                        for(uint32_t row = faces[slice][v]; row; row &= row - 1)
+                        {
+                            unsigned int u = __builtin_ctz(row), group = texture_groups[face][blocks[block + (u * u_stride)]];
+                            texture_rows[group][v] |= 1U << u;
+                            textures_used |= 1 << group;
+                        }
+                    }
 
-                // printf("g. min: %f %f %f\n", cursor->min.x, cursor->min.y, cursor->min.z);
-                // printf("g. size: %f %f %f\n", cursor->size.x, cursor->size.y, cursor->size.z);
-                // printf("%d\n", num_to_visit);
-                if(!num_to_visit) break;
-                cursor = to_visit[--num_to_visit];
+                    for(; textures_used; textures_used &= textures_used - 1)
+                    {
+                        uint32_t* texture_faces = texture_rows[__builtin_ctz(textures_used)];
+                        for(unsigned int v = 0; v < CHUNK_SIZE; v++)
+                        {
+                            while(texture_faces[v])
+                            {
+                                // The rectangle is the first run of faces in the row, grown down for as long as the next row has all of the run
+                                unsigned int u = __builtin_ctz(texture_faces[v]), height = 1;
+                                uint32_t after_run = ~(texture_faces[v] >> u);
+                                unsigned int width = after_run ? (unsigned int)__builtin_ctz(after_run) : CHUNK_SIZE - u;
+                                uint32_t run = (width == 32 ? 0xFFFFFFFFU : (1U << width) - 1) << u;
+                                for(texture_faces[v] &= ~run; v + height < CHUNK_SIZE && (texture_faces[v + height] & run) == run; height++) texture_faces[v + height] &= ~run;
+                                add_face_rectangle(to_recalculate, dst_model, section, face, slice, u, v, width, height);
+                            }
+                        }
+                    }
+                }
             }
         }
     }
@@ -448,8 +811,8 @@ CUBE_TREE* parent_tree(CHUNK* chunk, vec3 position, bool for_transparency)
 
 void place_block(CHUNK* chunk, BLOCK_TYPE type, vec3 position, bool recalculate_model)
 {
-    get_cube(chunk, position)->type = type;
-    if(type == WATER || type == LEAVES)
+    edit_cube(chunk, position)->type = type;
+    if(transparent_block(type))
         cube_tree_fill(chunk, parent_tree(chunk, position, true), position);
     else
         cube_tree_fill(chunk, parent_tree(chunk, position, false), position);
@@ -467,130 +830,564 @@ void remove_block(CHUNK* chunk, vec3 position, bool recalulate_model)
 CHUNK* allocate_chunk_memory()
 {
     CHUNK* to_return = calloc(1, sizeof(CHUNK));
-    to_return->model = make_model(VERTEX_POSITION | VERTEX_UV | VERTEX_UV2, CHUNK_INITIAL_ALLOC_BLOCKS * 8, CHUNK_INITIAL_ALLOC_BLOCKS * 16, NULL, NULL);
-    to_return->transparency_model = make_model(VERTEX_POSITION | VERTEX_UV | VERTEX_UV2, CHUNK_INITIAL_ALLOC_BLOCKS * 8, CHUNK_INITIAL_ALLOC_BLOCKS * 16, NULL, NULL);
-    to_return->cubes = calloc(CHUNK_SIZE * CHUNK_MAX_HEIGHT * CHUNK_SIZE, sizeof(CUBE));
-    to_return->cube_child_buffer = calloc(CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE * (CHUNK_MAX_HEIGHT / CHUNK_SIZE) * 2, sizeof(CUBE_TREE));
-    to_return->index_texture_data = calloc(CHUNK_INDEX_TEXTURE_SIZE * CHUNK_INDEX_TEXTURE_SIZE, sizeof(GLuint));
+    to_return->model = make_quad_model(VERTEX_PACKED, CHUNK_INITIAL_ALLOC_BLOCKS * 8);
+    to_return->transparency_model = make_quad_model(VERTEX_PACKED, CHUNK_INITIAL_ALLOC_BLOCKS * 8);
+    if(block_texturing == BLOCK_TEXTURING_INDEX_TEXTURE) to_return->index_texture_data = calloc(CHUNK_INDEX_TEXTURE_WIDTH * CHUNK_INDEX_TEXTURE_HEIGHT, sizeof(unsigned char));
     return to_return;
 }
 
+// Empties a section of the chunk, so that it can be generated again. The blocks are freed, since the new terrain might not need them
+void reset_chunk_section(CHUNK* chunk, unsigned int section)
+{
+    free(chunk->sections[section]);
+    chunk->sections[section] = NULL;
+    chunk->uniform_cubes[section].type = EMPTY;
+    chunk->cube_fill_state[section] = (CUBE_TREE){ .full = CHUNK_EMPTY, .min = v3(0, section * CHUNK_SIZE, 0), .size = full_chunk };
+    chunk->transparency_fill_state[section] = (CUBE_TREE){ .full = CHUNK_EMPTY, .min = v3(0, section * CHUNK_SIZE, 0), .size = full_chunk };
+    chunk->generated_sections &= ~(1 << section);
+}
+
+// Empties every section of the chunk. The tree nodes are kept allocated for the next time the chunk is generated
+void reset_chunk_sections(CHUNK* chunk)
+{
+    for(unsigned int i = 0; i < CHUNK_SECTIONS; i++) reset_chunk_section(chunk, i);
+    chunk->num_tree_nodes = 0;
+    chunk->stale_transparency_trees = 0;
+}
+
+// Builds a fill state tree from the blocks already in its section - the transparent blocks if transparent is set, or the solid blocks otherwise.
+// Like cube_tree_fill_columns, nodes which are completely full or completely empty aren't split up any further
+CHUNK_FILL_STATE cube_tree_fill_blocks(CHUNK* chunk, CUBE_TREE* tree, bool transparent)
+{
+    unsigned int x_min = tree->min.x, y_min = tree->min.y, z_min = -tree->min.z, size = tree->size.x, num_in_tree = 0;
+    for(unsigned int y = y_min; y < y_min + size; y++)
+    {
+        for(unsigned int z = z_min; z < z_min + size; z++)
+        {
+            for(unsigned int x = x_min; x < x_min + size; x++)
+            {
+                BLOCK_TYPE type = get_cube(chunk, at(x, y, -(int)z))->type;
+                if(type != EMPTY && transparent_block(type) == transparent) num_in_tree++;
+            }
+        }
+    }
+    if(!num_in_tree) return tree->full = CHUNK_EMPTY;
+    if(num_in_tree == size * size * size) return tree->full = CHUNK_FULL;
+
+    vec3 child_size = vec3_divide_scalar(tree->size, 2);
+    for(unsigned char i = 0; i < 8; i++)
+    {
+        CUBE_TREE child = { .full = CHUNK_EMPTY, .min = vec3_add_vec3(tree->min, vec3_scale(child_size, tree_child_transformations[i])), .size = child_size };
+        if(cube_tree_fill_blocks(chunk, &child, transparent) != CHUNK_EMPTY)
+        {
+            tree->children[i] = allocate_tree_node(chunk);
+            *(tree->children[i]) = child;
+        }
+    }
+    return tree->full = CHUNK_PARTIALLY_FULL;
+}
+
 void initialize_chunk_buffer(unsigned int buffer_size)
 {
     chunks = calloc(buffer_size, sizeof(CHUNK*));
     for(unsigned int i = 0; i < buffer_size; i++) chunks[i] = allocate_chunk_memory();
 }
 
-// Optionally, the chunk can be generated into an already existing allocated chunk object - place_into. If this is null, memory will be allocated anew
-CHUNK* make_chunk(vec3 position, CHUNK* place_into)
+typedef struct COLUMN_SPAN
 {
-    CHUNK* to_return = place_into;
-    if(!to_return) to_return = allocate_chunk_memory();
+    BLOCK_TYPE type;
+    unsigned short y_start, y_end; // The span covers the blocks from y_start up to, but not including, y_end
+} COLUMN_SPAN;
 
-    to_return->position = position;
-    to_return->tranform = translate(to_return->position);
+// The block a column's spans put at height y
+BLOCK_TYPE column_span_block(const COLUMN_SPAN* span, unsigned int y) { return y < span[0].y_end ? span[0].type : y < span[1].y_end ? span[1].type : y < span[2].y_end ? span[2].type : EMPTY; }
 
-    for(unsigned int i = 0; i < CHUNK_MAX_HEIGHT / CHUNK_SIZE; i++)
+// Writes one layer of blocks, at height y, from the spans of every column. The layer is written in the order its blocks are laid out in, a row across x at a time,
+// and each run of the same block along a row is copied in one go from block_rows, which holds a whole row of each type of block
+void fill_span_layer(CUBE* layer, unsigned int y, const COLUMN_SPAN (*spans)[3], const CUBE (*block_rows)[CHUNK_SIZE])
+{
+    for(unsigned int row = 0; row < CHUNK_SIZE * CHUNK_SIZE; row += CHUNK_SIZE)
     {
-        to_return->cube_fill_state[i].min = v3(0, i * CHUNK_SIZE, 0);
-        to_return->cube_fill_state[i].size = full_chunk;
-        to_return->transparency_fill_state[i].min = v3(0, i * CHUNK_SIZE, 0);
-        to_return->transparency_fill_state[i].size = full_chunk;
+        for(unsigned int x = 0, run_end; x < CHUNK_SIZE; x = run_end)
+        {
+            BLOCK_TYPE type = column_span_block(spans[row + x], y);
+            for(run_end = x + 1; run_end < CHUNK_SIZE && column_span_block(spans[row + run_end], y) == type; run_end++);
+            memcpy(layer + row + x, block_rows[type], (run_end - x) * sizeof(CUBE));
+        }
     }
+}
 
-    bool water_block;
-    unsigned char noise_val[4] = { 0 }, terrain_height;
+// Works out where the stone in a column stops, and where the soil stops (which is where the surface block or water goes), from the height of the terrain above the base level
+void column_heights(float height, int* stone_height, int* solid_height)
+{
+    int terrain_height = BASE_LEVEL + height;
+    if(terrain_height < 0) terrain_height = 0;
+    if(terrain_height > CHUNK_MAX_HEIGHT - 2) terrain_height = CHUNK_MAX_HEIGHT - 2;
+    *stone_height = BASE_LEVEL + ((terrain_height - BASE_LEVEL) / 4);
+    *solid_height = *stone_height > terrain_height + 1 ? *stone_height : terrain_height + 1;
+}
 
-    vec3 cube_position;
-    #ifdef DEBUG
-    LARGE_INTEGER chunk_gen_start_time, chunk_gen_end_time;
-    QueryPerformanceCounter(&chunk_gen_start_time);
-    #endif
-    // Generate terrain and water blocks based on terrain height
+// Generates terrain and water blocks based on the height of the terrain in each column. Each column is only a few runs of the same block 
+// (stone, then soil, then either water or a single surface block), so these are worked out as spans and written straight into the chunk a layer at a time, 
+// then both fill state trees are built from the range each column covers rather than one block at a time. Sections below every column's
+// soil are solid stone, and sections above every column's surface are empty, so neither of these have any blocks allocated
+void generate_heightmap_terrain(CHUNK* chunk)
+{
+    int stone_height, solid_height;
+    float heights[CHUNK_SIZE * CHUNK_SIZE];
+    CLIMATE climate[CHUNK_SIZE * CHUNK_SIZE];
+    COLUMN_SPAN spans[CHUNK_SIZE * CHUNK_SIZE][3];
+    unsigned short solid_tops[CHUNK_SIZE * CHUNK_SIZE] = { 0 }, solid_bottoms[CHUNK_SIZE * CHUNK_SIZE] = { 0 };
+    unsigned short water_tops[CHUNK_SIZE * CHUNK_SIZE] = { 0 }, water_bottoms[CHUNK_SIZE * CHUNK_SIZE] = { 0 };
+    int lowest_stone = CHUNK_MAX_HEIGHT, highest_top = 0;
+    CUBE block_rows[NUM_BLOCK_TYPES + 1][CHUNK_SIZE];
+    for(unsigned int type = 0; type <= NUM_BLOCK_TYPES; type++)
+        for(unsigned int x = 0; x < CHUNK_SIZE; x++) block_rows[type][x] = (CUBE){ .type = type };
+    climate_terrain_heightmap(heights, chunk->position.x, -chunk->position.z, CHUNK_SIZE);
+    sample_climate(climate, chunk->position.x, -chunk->position.z, CHUNK_SIZE, 1);
+    for(unsigned int column = 0; column < CHUNK_SIZE * CHUNK_SIZE; column++)
+    {
+        const BIOME_PALETTE* palette = biome_palettes + biome_from_climate(climate[column]);
+        column_heights(heights[column], &stone_height, &solid_height);
+        if(stone_height < 0) stone_height = 0;
+
+        spans[column][0] = (COLUMN_SPAN){ .type = STONE, .y_start = 0, .y_end = stone_height };
+        spans[column][1] = (COLUMN_SPAN){ .type = palette->filler, .y_start = stone_height, .y_end = solid_height };
+        if(solid_height <= BASE_LEVEL + WATER_LEVEL)
+        {
+            water_bottoms[column] = solid_height;
+            water_tops[column] = BASE_LEVEL + WATER_LEVEL + 1;
+            spans[column][2] = (COLUMN_SPAN){ .type = WATER, .y_start = water_bottoms[column], .y_end = water_tops[column] };
+        }
+        else spans[column][2] = (COLUMN_SPAN){ .type = palette->surface, .y_start = solid_height, .y_end = ++solid_height };
+        solid_tops[column] = solid_height;
+
+        if(stone_height < lowest_stone) lowest_stone = stone_height;
+        if(spans[column][2].y_end > highest_top) highest_top = spans[column][2].y_end;
+    }
+
+    for(unsigned int section = 0; section < CHUNK_SECTIONS; section++)
+    {
+        int y_min = section * CHUNK_SIZE, y_max = y_min + CHUNK_SIZE;
+        chunk->generated_sections |= 1 << section;
+        if(y_min >= highest_top) continue;
+        if(y_max <= lowest_stone)
+        {
+            chunk->uniform_cubes[section].type = STONE;
+            chunk->cube_fill_state[section].full = CHUNK_FULL;
+            continue;
+        }
+
+        // Layers below every column's soil are all stone, so once one of them is written the rest are copied from the layer below
+        CUBE* cubes = chunk_section(chunk, section);
+        for(int y = y_min; y < y_max && y < highest_top; y++)
+        {
+            CUBE* layer = cubes + (y - y_min) * CHUNK_SIZE * CHUNK_SIZE;
+            if(y > y_min && y < lowest_stone) memcpy(layer, layer - CHUNK_SIZE * CHUNK_SIZE, CHUNK_SIZE * CHUNK_SIZE * sizeof(CUBE));
+            else fill_span_layer(layer, y, spans, block_rows);
+        }
+        cube_tree_fill_columns(chunk, chunk->cube_fill_state + section, solid_bottoms, solid_tops);
+        cube_tree_fill_columns(chunk, chunk->transparency_fill_state + section, water_bottoms, water_tops);
+    }
+}
+
+// Generates one section of terrain from a 3D density field. The density is only evaluated on a coarse lattice, and if the lattice proves the section to be
+// completely solid or completely empty, it is filled in (or skipped) as a whole without visiting each block. The cave noise has a finer lattice of its own,
+// which is only evaluated once the section is known to have some solid blocks. Returns whether the section is completely solid
+bool generate_density_section(CHUNK* chunk, unsigned int section)
+{
+    unsigned int step = terrain_density_step(CHUNK_SIZE), points_per_side = CHUNK_SIZE / step + 1, points_high = CHUNK_SIZE / step + 1;
+    unsigned int y_min = section * CHUNK_SIZE, y_max = y_min + CHUNK_SIZE;
+    float lattice[TERRAIN_MAX_LATTICE_POINTS * (CHUNK_SIZE / TERRAIN_MIN_DENSITY_STEP + 1)], lowest, highest;
+    float caves[TERRAIN_CAVE_LATTICE_SIZE * TERRAIN_CAVE_LATTICE_SIZE * TERRAIN_CAVE_LATTICE_SIZE];
+    float height_scales[TERRAIN_MAX_LATTICE_POINTS], height_offsets[TERRAIN_MAX_LATTICE_POINTS];
+
+    climate_height_lattice(height_scales, height_offsets, chunk->position.x, -chunk->position.z, points_per_side, step);
+    terrain_density_lattice(lattice, chunk->position.x, -chunk->position.z, y_min, BASE_LEVEL, height_scales, height_offsets, step, points_per_side, points_high);
+    terrain_density_bounds(lattice, step, points_per_side, 0, CHUNK_SIZE, &lowest, &highest);
+    chunk->generated_sections |= 1 << section;
+    if(highest <= 0 && y_min > BASE_LEVEL + WATER_LEVEL) return false; // Completely empty, and too high up for any water
+
+    // Every block is interpolated from the cave lattice, so if all of it is further from zero than the threshold, on the same side, there are no caves here
+    bool has_caves = terrain_settings.cave_threshold > 0 && y_max > TERRAIN_CAVE_FLOOR && highest > 0;
+    if(has_caves)
+    {
+        float lowest_cave, highest_cave;
+        terrain_cave_lattice(caves, chunk->position.x, -chunk->position.z, y_min, TERRAIN_CAVE_STEP, TERRAIN_CAVE_LATTICE_SIZE, TERRAIN_CAVE_LATTICE_SIZE);
+        terrain_density_bounds(caves, TERRAIN_CAVE_STEP, TERRAIN_CAVE_LATTICE_SIZE, 0, CHUNK_SIZE, &lowest_cave, &highest_cave);
+        has_caves = lowest_cave < terrain_settings.cave_threshold && highest_cave > -terrain_settings.cave_threshold;
+    }
+    if(lowest > 0 && !has_caves)
+    {
+        // Completely solid - the surface blocks are dressed afterwards, so stone is fine for now
+        chunk->uniform_cubes[section].type = STONE;
+        chunk->cube_fill_state[section].full = CHUNK_FULL;
+        return true;
+    }
+
+    for(unsigned int k = 0; k < CHUNK_SIZE; k++)
+        for(int j = 0; j < CHUNK_SIZE; j++)
+            for(unsigned int i = 0; i < CHUNK_SIZE; i++)
+                if(terrain_density_at(lattice, step, points_per_side, i, k, j) > 0 && !(has_caves && terrain_cave_at(caves, TERRAIN_CAVE_STEP, TERRAIN_CAVE_LATTICE_SIZE, i, k, j, y_min + k)))
+                    place_block(chunk, STONE, at(i, y_min + k, -j), false);
+    return false;
+}
+
+// Generates terrain from a 3D density field, which allows for caves and overhangs. Sections are generated from the top down, stopping either at a section
+// which turns out to be completely solid, or once the sections are deep underground. Neither of these can be seen from the surface, so the sections below
+// are left as solid stone until something needs them (see require_chunk_section)
+void generate_density_terrain(CHUNK* chunk)
+{
+    unsigned int step = terrain_lattice_step(CHUNK_SIZE), points_per_side = CHUNK_SIZE / step + 1;
+    float surface[TERRAIN_MAX_LATTICE_POINTS], height_scales[TERRAIN_MAX_LATTICE_POINTS], height_offsets[TERRAIN_MAX_LATTICE_POINTS], lowest_surface = CHUNK_MAX_HEIGHT;
+    CLIMATE climate[CHUNK_SIZE * CHUNK_SIZE];
+    sample_climate(climate, chunk->position.x, -chunk->position.z, CHUNK_SIZE, 1);
+    climate_height_lattice(height_scales, height_offsets, chunk->position.x, -chunk->position.z, points_per_side, step);
+    terrain_height_lattice(surface, chunk->position.x, -chunk->position.z, height_scales, height_offsets, step, points_per_side, TERRAIN_POINT_BLOCKS);
+    for(unsigned int i = 0; i < points_per_side * points_per_side; i++) if(BASE_LEVEL + surface[i] < lowest_surface) lowest_surface = BASE_LEVEL + surface[i];
+
+    int section = CHUNK_SECTIONS - 1;
+    for(; section >= 0; section--)
+    {
+        if((section + 1) * CHUNK_SIZE + UNDERGROUND_SECTION_DEPTH <= lowest_surface) break;
+        if(generate_density_section(chunk, section)) { section--; break; }
+    }
+    for(; section >= 0; section--)
+    {
+        chunk->uniform_cubes[section].type = STONE;
+        chunk->cube_fill_state[section].full = CHUNK_FULL;
+    }
+
+    // Dress the top of each column with grass and soil, and fill the open space above it with water up to the water level
     for(unsigned int i = 0; i < CHUNK_SIZE; i++)
     {
         for(int j = 0; j < CHUNK_SIZE; j++)
         {
-            water_block = false;
-            unsigned int k = 0;
-            for(;k < CHUNK_MAX_HEIGHT; k++)
-            {
-                simplex(noise_val, position.x + i / 4, (-position.z) + (j / 4));
-                terrain_height = BASE_LEVEL + ((float)noise_val[0] / 255) * 40;
-                if(k < BASE_LEVEL + ((terrain_height - BASE_LEVEL) / 4)) place_block(to_return, STONE, at(i, k, -j), false); 
-                else if(k <= terrain_height) { place_block(to_return, SOIL, at(i, k, -j), false); }
-                else if(k > terrain_height && k <= BASE_LEVEL + WATER_LEVEL) { water_block = true; place_block(to_return, WATER, at(i, k, -j), false); }
-                else if(k > terrain_height && !water_block) { place_block(to_return, GRASS, at(i, k, -j), false); break; }
-            }
+            int k = CHUNK_MAX_HEIGHT - 1;
+            for(; k >= 0 && get_cube(chunk, at(i, k, -j))->type == EMPTY; k--)
+                if(k <= BASE_LEVEL + WATER_LEVEL) place_block(chunk, WATER, at(i, k, -j), false);
+            if(k < 0) continue;
+
+            const BIOME_PALETTE* palette = biome_palettes + biome_from_climate(climate[j * CHUNK_SIZE + i]);
+            edit_cube(chunk, at(i, k, -j))->type = k >= BASE_LEVEL + WATER_LEVEL ? palette->surface : palette->filler;
+            for(int depth = 1; depth <= 3 && k - depth >= 0 && get_cube(chunk, at(i, k - depth, -j))->type == STONE; depth++)
+                edit_cube(chunk, at(i, k - depth, -j))->type = palette->filler;
         }
     }
+}
+
+// Sets a block which is part of a structure, at (x, y, -z) in the chunk, if it has a higher priority than the block already there (see structure_block_priority).
+// Moving a block out of a fill state tree isn't supported, so when leaves are covered by a solid block, the section's transparency tree is marked to be built
+// again from its blocks - call rebuild_stale_trees once the structure's blocks are all in place
+void place_structure_block(CHUNK* chunk, BLOCK_TYPE type, unsigned int x, unsigned int y, unsigned int z)
+{
+    CUBE* cube = get_cube(chunk, at(x, y, -(int)z));
+    if(structure_block_priority[type] <= structure_block_priority[cube->type]) return;
+    if(cube->type == LEAVES) chunk->stale_transparency_trees |= 1 << (y / CHUNK_SIZE);
+    if(cube->type != EMPTY && cube->type != LEAVES) edit_cube(chunk, at(x, y, -(int)z))->type = type; // The block is already in the solid tree, so only its type changes
+    else place_block(chunk, type, at(x, y, -(int)z), false);
+}
+
+// Builds the transparency trees which stamp_structure or place_structure_block marked as stale again from the blocks in their sections. The old nodes are left unused until
+// the chunk is reset, but leaves are only ever covered where structures overlap, so this rarely happens
+void rebuild_stale_trees(CHUNK* chunk)
+{
+    for(unsigned int section = 0; section < CHUNK_SECTIONS; section++)
+    {
+        if(!(chunk->stale_transparency_trees & (1 << section))) continue;
+        chunk->transparency_fill_state[section] = (CUBE_TREE){ .full = CHUNK_EMPTY, .min = v3(0, section * CHUNK_SIZE, 0), .size = full_chunk };
+        cube_tree_fill_blocks(chunk, chunk->transparency_fill_state + section, true);
+    }
+    chunk->stale_transparency_trees = 0;
+}
+
+// Copies the blocks of a structure template into the chunk, with the bottom of its anchor column replacing the block at ground. The part of each row of the template
+// inside the chunk is merged straight into the section's blocks by priority (see structure_block_priority), and only the blocks which went into empty space are
+// added to a fill state tree. The blocks outside of the chunk are gathered up for each neighbouring chunk and left in its pending writes
+void stamp_structure(CHUNK* chunk, const STRUCTURE_TEMPLATE* template, vec3 ground)
+{
+    PENDING_BLOCK spilled[STRUCTURE_MAX_SIZE * STRUCTURE_MAX_SIZE * STRUCTURE_MAX_SIZE], gathered[STRUCTURE_MAX_SIZE * STRUCTURE_MAX_SIZE * STRUCTURE_MAX_SIZE];
+    unsigned char spilled_into[STRUCTURE_MAX_SIZE * STRUCTURE_MAX_SIZE * STRUCTURE_MAX_SIZE]; // Which neighbour each spilled block is in, as (z + 1) * 3 + (x + 1)
+    unsigned int num_spilled = 0;
+    int origin_x = ground.x - template->anchor_x, origin_y = ground.y, origin_z = -ground.z - template->anchor_z;
+    int y_end = origin_y + template->height > CHUNK_MAX_HEIGHT ? CHUNK_MAX_HEIGHT - origin_y : template->height;
 
-    // Generate trees
-    for(unsigned int i = 0; i < 10; i++)
+    // The part of the template inside the chunk, in template coordinates
+    int x_start = origin_x < 0 ? -origin_x : 0, x_end = origin_x + template->width > CHUNK_SIZE ? CHUNK_SIZE - origin_x : template->width;
+    int z_start = origin_z < 0 ? -origin_z : 0, z_end = origin_z + template->depth > CHUNK_SIZE ? CHUNK_SIZE - origin_z : template->depth;
+    for(int y = 0; y < y_end; y++)
     {
-        int x = (rand() / (float)RAND_MAX) * CHUNK_SIZE;
-        int z = (rand() / (float)RAND_MAX) * -CHUNK_SIZE;
-        float probability = 1.0;
-        vec3 top_cube_position = top_cube(to_return, x, z), leaf_position;
-        CUBE* cube = get_cube(to_return, top_cube_position), *leaf_cube;
-        if(cube->type == GRASS || cube->type == SOIL)
+        unsigned int section = (origin_y + y) / CHUNK_SIZE;
+        for(int z = 0; z < template->depth; z++)
         {
-            cube->type = SOIL;
-            for(unsigned int i = 0; i < ((rand() / (float)RAND_MAX * 4) + 3) - 1; i++)
+            const unsigned char* row = template->blocks + (z * template->width) + (y * template->width * template->depth);
+            int chunk_z = origin_z + z, neighbour_z = floor_divide(chunk_z, CHUNK_SIZE);
+            bool inside = z >= z_start && z < z_end;
+            for(int x = 0; x < template->width; x++)
             {
-                top_cube_position = vec3_add_vec3(top_cube_position, v3(0.0, 1.0, 0.0));
-                place_block(to_return, WOOD, top_cube_position, false);
+                if(row[x] == EMPTY || (inside && x >= x_start && x < x_end)) continue;
+                int chunk_x = origin_x + x, neighbour_x = floor_divide(chunk_x, CHUNK_SIZE);
+                spilled_into[num_spilled] = (neighbour_z + 1) * 3 + (neighbour_x + 1);
+                spilled[num_spilled++] = (PENDING_BLOCK){ .x = chunk_x - neighbour_x * CHUNK_SIZE, .y = origin_y + y, .z = chunk_z - neighbour_z * CHUNK_SIZE, .type = row[x] };
             }
+            if(!inside || x_start >= x_end) continue;
 
-            top_cube_position = vec3_add_vec3(top_cube_position, v3(0.0, 1.0, 0.0));
-            place_block(to_return, WOOD_TOP, top_cube_position, false);
-
-            for(unsigned int i = 0; i < 42 * 3; i++)
-            { 
-                float x_pos = (float)(i % 7) - 3, y_pos = (float)(i / 42) - 1, z_pos = -(float)((i  % 42 ) / 7) + 3;
-                float distance = sqrtf(x_pos * x_pos + y_pos * y_pos + z_pos * z_pos); 
-                if((float)rand() / RAND_MAX < probability * fmaxf(0.0, (3.0 - distance)))
-                {
-                    leaf_position = vec3_add_vec3(top_cube_position, v3(x_pos, y_pos, z_pos));
-                    if(leaf_position.x < 0 || leaf_position.y < 0 || leaf_position.z > 0 || leaf_position.x >= CHUNK_SIZE || leaf_position.y >= CHUNK_MAX_HEIGHT || leaf_position.z <= -CHUNK_SIZE) continue;
-                    leaf_cube = get_cube(to_return, leaf_position);
-                    if(leaf_cube->type == EMPTY)
-                        place_block(to_return, LEAVES, leaf_position, false);
-                }
+            // The blocks of the section are only allocated once a block in it actually changes
+            CUBE* cubes = chunk->sections[section] ? chunk->sections[section] + (chunk_z * CHUNK_SIZE) + ((origin_y + y) % CHUNK_SIZE) * CHUNK_SIZE * CHUNK_SIZE : NULL;
+            for(int x = x_start; x < x_end; x++)
+            {
+                BLOCK_TYPE existing = cubes ? cubes[origin_x + x].type : chunk->uniform_cubes[section].type;
+                if(structure_block_priority[row[x]] <= structure_block_priority[existing]) continue;
+                if(!cubes) cubes = chunk_section(chunk, section) + (chunk_z * CHUNK_SIZE) + ((origin_y + y) % CHUNK_SIZE) * CHUNK_SIZE * CHUNK_SIZE;
+                if(existing == LEAVES) chunk->stale_transparency_trees |= 1 << section;
+                cubes[origin_x + x].type = row[x];
+                if(existing == EMPTY || existing == LEAVES)
+                    cube_tree_fill(chunk, (transparent_block(row[x]) ? chunk->transparency_fill_state : chunk->cube_fill_state) + section, at(origin_x + x, origin_y + y, -chunk_z));
             }
-        } 
+        }
     }
 
-    recalculate_chunk_model(to_return, false);
-    recalculate_chunk_model(to_return, true);
+    // Going further along z in the cube array means going backwards in the world, so the neighbours in that direction have lower chunk coordinates
+    for(unsigned char neighbour = 0; neighbour < 9 && num_spilled; neighbour++)
+    {
+        unsigned int num_gathered = 0;
+        for(unsigned int i = 0; i < num_spilled; i++) if(spilled_into[i] == neighbour) gathered[num_gathered++] = spilled[i];
+        if(num_gathered) add_pending_write(chunk_coordinate(chunk->position.x) + (neighbour % 3) - 1, chunk_coordinate(chunk->position.z) - (neighbour / 3) + 1, gathered, num_gathered);
+    }
+    rebuild_stale_trees(chunk);
+}
+
+// Places any blocks which structures in neighbouring chunks have left for this chunk since the last time this was called. The writes older than the newest
+// one are then folded into a single write, so that the list doesn't keep growing each time a neighbour is generated again and spills the same blocks
+void apply_pending_writes(CHUNK* chunk)
+{
+    PENDING_WRITE* newest = SDL_AtomicGetPtr(&chunk->pending->writes);
+    if(newest == chunk->applied_writes) return;
+    for(PENDING_WRITE* write = newest; write != chunk->applied_writes; write = write->next)
+        for(unsigned int i = 0; i < write->num_blocks; i++)
+            place_structure_block(chunk, write->blocks[i].type, write->blocks[i].x, write->blocks[i].y, write->blocks[i].z);
+    rebuild_stale_trees(chunk);
+    chunk->applied_writes = newest;
+    compact_pending_writes(newest);
+}
+
+// Generates a section of the chunk which was left until it was needed, if it hasn't been generated yet. Returns whether it had to be generated, in which case
+// the chunk's models are out of date. Heightmap terrain generates every section straight away, so this only does anything for density terrain
+bool require_chunk_section(CHUNK* chunk, unsigned int section)
+{
+    if(section >= CHUNK_SECTIONS || chunk->generated_sections & (1 << section)) return false;
+    reset_chunk_section(chunk, section);
+    generate_density_section(chunk, section);
+    return chunk->model_outdated = true;
+}
+
+// Places a number of structures of one type at random points in the chunk, choosing a random variant for each
+void place_structures(CHUNK* chunk, STRUCTURE_TYPE type, unsigned int count)
+{
+    int chunk_x = chunk_coordinate(chunk->position.x), chunk_z = chunk_coordinate(chunk->position.z);
+    for(unsigned int i = 0; i < count; i++)
+    {
+        unsigned int counter = (type * 256) + i;
+        int x = random_float(chunk_x, chunk_z, FEATURE_STRUCTURE_POSITION, counter * 2) * CHUNK_SIZE;
+        int z = random_float(chunk_x, chunk_z, FEATURE_STRUCTURE_POSITION, counter * 2 + 1) * -CHUNK_SIZE;
+        vec3 ground = top_cube(chunk, x, z);
+        BLOCK_TYPE ground_type = get_cube(chunk, ground)->type;
+        if(structure_needs_soil[type] ? (ground_type == GRASS || ground_type == SOIL) : (ground_type != EMPTY && ground_type != WATER && ground_type != LEAVES))
+            stamp_structure(chunk, get_structure(type, random_bits(chunk_x, chunk_z, FEATURE_STRUCTURE_VARIANT, counter)), ground);
+    }
+}
+
+// A hash of every block in the chunk - since generation doesn't depend on the order chunks are generated in, the same seed always gives the same hash
+unsigned long long chunk_hash(CHUNK* chunk)
+{
+    unsigned long long hash = 0xCBF29CE484222325ULL;
+    for(unsigned int section = 0; section < CHUNK_SECTIONS; section++)
+        for(unsigned long i = 0; i < CHUNK_SECTION_BLOCKS; i++)
+            hash = (hash ^ (chunk->sections[section] ? chunk->sections[section][i].type : chunk->uniform_cubes[section].type)) * 0x100000001B3ULL;
+    return hash;
+}
+
+// Clears out the chunk's models, and builds them again with whichever mesher chunk_mesher is set to
+void build_chunk_model(CHUNK* chunk)
+{
+    chunk->model->num_vertices = chunk->model->num_indices = 0;
+    chunk->transparency_model->num_vertices = chunk->transparency_model->num_indices = 0;
+    chunk->index_texture_offset_x = chunk->index_texture_offset_y = chunk->index_texture_highest_y_offset = chunk->index_texture_columns_used = 0;
+    if(chunk_mesher == CHUNK_MESHER_BINARY)
+    {
+        recalculate_chunk_model_binary(chunk, false);
+        recalculate_chunk_model_binary(chunk, true);
+    }
+    else
+    {
+        recalculate_chunk_model(chunk, false);
+        recalculate_chunk_model(chunk, true);
+    }
+    chunk->model_outdated = false;
+}
+
+// Empties a chunk and moves it to a new position, ready for its blocks to be generated or loaded
+void prepare_chunk(CHUNK* chunk, vec3 position)
+{
+    // If the chunk is being reused for one which was already loaded, blocks spilled into the old chunk no longer need to mark it dirty
+    if(chunk->pending) SDL_AtomicSet(&(chunk->pending->generated), 0);
+    chunk->position = position;
+    chunk->tranform = translate(chunk->position);
+    chunk->pending = find_pending_chunk(chunk_coordinate(position.x), chunk_coordinate(position.z));
+    chunk->applied_writes = NULL;
+    chunk->borders_known = 0;
+    SDL_AtomicSet(&(chunk->pending->dirty), 0);
+    reset_chunk_sections(chunk);
+}
+
+// Adds the blocks which neighbouring chunks' structures spilled into a chunk, once its own blocks are in place. Overlapping blocks are settled by priority
+// (see structure_block_priority), so the result is the same whichever order the chunks are generated in and the blocks arrive in.
+// Anything spilled into the chunk while the first lot are being placed is caught by the second pass, and anything after that marks the chunk dirty
+void apply_neighbour_writes(CHUNK* chunk)
+{
+    apply_pending_writes(chunk);
+    SDL_AtomicSet(&(chunk->pending->generated), 1);
+    apply_pending_writes(chunk);
+}
+
+// Finishes off a chunk once its own blocks are in place, by adding the blocks which neighbouring chunks' structures spilled into it and building its models
+void complete_chunk(CHUNK* chunk)
+{
+    apply_neighbour_writes(chunk);
+    build_chunk_model(chunk);
+}
+
+// Generates the terrain of a chunk which has been prepared with prepare_chunk
+void generate_chunk_terrain(CHUNK* chunk)
+{
+    if(terrain_settings.density_terrain) generate_density_terrain(chunk);
+    else generate_heightmap_terrain(chunk);
+}
+
+// Generates trees and other structures on a chunk's terrain - how many depends on the biome in the middle of the chunk
+void decorate_chunk(CHUNK* chunk)
+{
+    CLIMATE centre_climate;
+    sample_climate(&centre_climate, chunk->position.x + CHUNK_SIZE / 2, -chunk->position.z + CHUNK_SIZE / 2, 1, 1);
+    for(unsigned int i = 0; i < NUM_STRUCTURE_TYPES; i++) place_structures(chunk, i, biome_palettes[biome_from_climate(centre_climate)].structures[i]);
+}
+
+// Optionally, the chunk can be generated into an already existing allocated chunk object - place_into. If this is null, memory will be allocated anew
+CHUNK* make_chunk(vec3 position, CHUNK* place_into)
+{
+    CHUNK* to_return = place_into;
+    if(!to_return) to_return = allocate_chunk_memory();
+    prepare_chunk(to_return, position);
+
+    #ifdef DEBUG
+    LARGE_INTEGER chunk_gen_start_time, chunk_gen_end_time;
+    QueryPerformanceCounter(&chunk_gen_start_time);
+    #endif
+    generate_chunk_terrain(to_return);
+    decorate_chunk(to_return);
+    complete_chunk(to_return);
     #ifdef DEBUG
     QueryPerformanceCounter(&chunk_gen_end_time);
     double genTime = ((double)(chunk_gen_end_time.QuadPart - chunk_gen_start_time.QuadPart) / frequency.QuadPart);
-    printf("Generated chunk at (%.2f, %.2f): took %lf seconds, %lu vertices, %lu indices\n", position.x, position.z, genTime, to_return->model->num_vertices, to_return->model->num_indices);
+    printf("Generated chunk at (%.2f, %.2f): took %lf seconds, %lu vertices, %lu indices, hash %016llx\n", position.x, position.z, genTime, to_return->model->num_vertices, to_return->model->num_indices, chunk_hash(to_return));
     #endif
     return to_return;
 }
 
-void finalise_chunk(CHUNK* to_finalise)
+// The number of rows at the start of a chunk's index texture which its models use (none if it doesn't have one)
+unsigned int chunk_index_rows_used(CHUNK* chunk)
 {
-    // Generate the texture index, then load the indices of all the vertices into it
-    glGenTextures(1, &(to_finalise->index_texture));
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, to_finalise->index_texture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    if(block_texturing != BLOCK_TEXTURING_INDEX_TEXTURE) return 0;
+    unsigned int rows_used = chunk->index_texture_offset_y + chunk->index_texture_highest_y_offset + 1;
+    return rows_used < CHUNK_INDEX_TEXTURE_HEIGHT ? rows_used : CHUNK_INDEX_TEXTURE_HEIGHT;
+}
+
+// The number of bytes upload_chunk sends to the gpu for a chunk
+size_t chunk_upload_size(CHUNK* chunk)
+{
+    size_t model_size = vertex_size(chunk->model->vertex_properties) * (chunk->model->num_vertices + chunk->transparency_model->num_vertices);
+    return model_size + chunk->index_texture_columns_used * chunk_index_rows_used(chunk);
+}
+
+// The number of bytes of gpu memory a chunk's models would take up if drawn with a quad rendering mode - four vertices for each face, or one packed face.
+// This leaves out the index texture, which is the same either way, and the shared quad index buffer which every chunk drawn from vertices uses
+size_t chunk_model_memory(CHUNK* chunk, QUAD_RENDERING mode)
+{
+    unsigned long num_faces = (chunk->model->num_indices + chunk->transparency_model->num_indices) / 6;
+    return num_faces * sizeof(BLOCK_VERTEX) * (mode == QUAD_RENDERING_PULLED ? 1 : 4);
+}
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, CHUNK_INDEX_TEXTURE_SIZE, CHUNK_INDEX_TEXTURE_SIZE, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, to_finalise->index_texture_data);
-    
+// Uploads the rows of a chunk's index texture which its models use into its region of the index atlas. If they don't fit (or the region is far bigger
+// than they need, as when the chunk is reused for another one), the chunk is given a new region first
+void upload_chunk_indices(CHUNK* chunk)
+{
+    if(block_texturing != BLOCK_TEXTURING_INDEX_TEXTURE) return;
+    unsigned int rows_used = chunk_index_rows_used(chunk), columns_used = chunk->index_texture_columns_used;
+    if(!index_region_fits(chunk->index_region, columns_used, rows_used))
+    {
+        free_index_region(&(chunk->index_region));
+        chunk->index_region = allocate_index_region(columns_used, rows_used);
+    }
+    upload_index_region(chunk->index_region, chunk->index_texture_data, CHUNK_INDEX_TEXTURE_WIDTH, columns_used, rows_used);
+}
+
+void finalise_chunk(CHUNK* to_finalise)
+{
     finalise_model(to_finalise->model);
     finalise_model(to_finalise->transparency_model);
+    upload_chunk_indices(to_finalise);
 }
 
-void render_chunk(CHUNK* to_render)
+// Uploads a chunk's models and index texture, after it has been built again (or generated again into a chunk which was already finalised).
+// Chunks which haven't been finalised yet are finalised instead. Only call this from the thread which owns the opengl context
+void upload_chunk(CHUNK* to_upload)
 {
+    if(!to_upload->model->vertex_array_object)
+    {
+        finalise_chunk(to_upload);
+        return;
+    }
+
+    upload_chunk_indices(to_upload);
+    update_model(to_upload->model);
+    update_model(to_upload->transparency_model);
+}
+
+// Applies any blocks neighbouring chunks have spilled into a chunk since it was generated, and if that or anything else has changed the chunk,
+// rebuilds its models. Returns whether they were rebuilt, in which case they need uploading again. This doesn't touch opengl, so it can run on any thread
+bool rebuild_chunk(CHUNK* to_rebuild)
+{
+    if(to_rebuild->pending && SDL_AtomicSet(&(to_rebuild->pending->dirty), 0))
+    {
+        apply_pending_writes(to_rebuild);
+        to_rebuild->model_outdated = true;
+    }
+    if(!to_rebuild->model_outdated) return false;
+    build_chunk_model(to_rebuild);
+    return true;
+}
+
+// Rebuilds a chunk with rebuild_chunk if anything has changed it, and uploads it again.
+// Returns whether anything had to be done. Only call this from the thread which owns the opengl context, once the chunk is finalised
+bool update_chunk(CHUNK* to_update)
+{
+    if(!rebuild_chunk(to_update)) return false;
+    upload_chunk(to_update);
+    return true;
+}
+
+// Binds the index atlas, and points the shaders at a chunk's region of it - which only the index texture mode has
+void use_index_region(INDEX_REGION* region)
+{
+    if(block_texturing != BLOCK_TEXTURING_INDEX_TEXTURE) return;
     glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, to_render->index_texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, index_atlas_texture);
+    set_shader_value(INDEX_REGION_ORIGIN, region);
+}
+
+void render_chunk(CHUNK* to_render)
+{
+    use_index_region(&(to_render->index_region));
     set_shader_value(MODEL_MATRIX, &(to_render->tranform));
     glEnable(GL_CULL_FACE);
     render_model(to_render->model);
@@ -600,11 +1397,12 @@ void render_chunk(CHUNK* to_render)
 
 void unload_chunk(CHUNK* to_free)
 {
+    free_index_region(&(to_free->index_region));
     unload_model(to_free->model);
     unload_model(to_free->transparency_model);
     free(to_free->index_texture_data);
-    free(to_free->cube_child_buffer);
-    free(to_free->cubes);
+    for(unsigned int i = 0; i < CHUNK_SECTIONS; i++) free(to_free->sections[i]);
+    for(unsigned int i = 0; i < CHUNK_MAX_TREE_NODE_BLOCKS; i++) free(to_free->tree_node_blocks[i]);
     free(to_free);
 }
 